@@ -0,0 +1,324 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include <arpa/inet.h>
+
+#include "config.h"
+#include "access-log.h"
+
+#define LOG_METHOD_MAX 16
+#define LOG_TEXT_MAX 256
+#define FLUSH_INTERVAL_MS 100
+#define WRITE_BUFFER_SIZE 65536
+
+enum log_record_type { LOG_RECORD_ACCESS, LOG_RECORD_ERROR };
+
+// records are copied out of the request as-is, and only formatted by the logging thread
+struct log_record {
+	enum log_record_type type;
+	int status;
+	int major_version;
+	int minor_version;
+	uint32_t addr;
+	time_t time;
+	size_t bytes;
+	uint64_t latency_ns;
+	size_t method_len;
+	char method[LOG_METHOD_MAX];
+	char text[LOG_TEXT_MAX]; ///< path for access records, message for errors
+};
+
+// single producer (an event loop), single consumer (the logging thread)
+struct log_ring {
+	_Alignas(64) size_t head; ///< next record to be written out, advanced by the consumer
+	_Alignas(64) size_t tail; ///< next free record, advanced by the producer
+	size_t dropped; ///< records dropped because the ring was full, written by the producer
+	size_t dropped_reported; ///< only touched by the consumer
+	size_t mask;
+	struct log_ring *next; ///< rings are never removed, so the list can be walked without the lock
+	struct log_record records[];
+};
+
+struct write_buffer {
+	int fd;
+	size_t len;
+	char buf[WRITE_BUFFER_SIZE];
+};
+
+static struct {
+	pthread_mutex_t lock; ///< protects the list of rings and waiting on wake
+	pthread_cond_t wake; ///< signalled when a ring is filling up
+	struct log_ring *rings;
+	int running;
+	int access_fd; ///< -1 if the access log is disabled
+} logger = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.wake = PTHREAD_COND_INITIALIZER,
+	.access_fd = -1
+};
+
+static _Thread_local struct log_ring *thread_ring;
+
+// Returns the calling event loop's ring, creating it if needed, or NULL if it can't be used
+static struct log_ring *get_ring(void) {
+	if (thread_ring || !__atomic_load_n(&logger.running, __ATOMIC_ACQUIRE)) return thread_ring;
+
+	// round up to a power of two so positions can be masked
+	size_t size = 1;
+	while (size < global_config.access_log_ring_size) size <<= 1;
+
+	struct log_ring *ring = aligned_alloc(64, (sizeof(*ring) + size * sizeof(struct log_record) + 63) & ~(size_t) 63);
+	if (!ring) return NULL;
+	ring->head = ring->tail = 0;
+	ring->dropped = ring->dropped_reported = 0;
+	ring->mask = size - 1;
+
+	pthread_mutex_lock(&logger.lock);
+	ring->next = logger.rings;
+	logger.rings = ring;
+	pthread_mutex_unlock(&logger.lock);
+
+	thread_ring = ring;
+	return ring;
+}
+
+// Returns a record to fill in, or NULL if it was dropped
+static struct log_record *reserve_record(struct log_ring *ring) {
+	size_t tail = ring->tail;
+	if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) <= ring->mask) {
+		return &ring->records[tail & ring->mask];
+	}
+
+	if (global_config.access_log_policy == LOG_POLICY_DROP) {
+		__atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	// the event loop was told it may wait, so hurry the logging thread along
+	while (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) > ring->mask) {
+		pthread_cond_signal(&logger.wake);
+		nanosleep(&(struct timespec) { .tv_nsec = 100000 }, NULL);
+	}
+	return &ring->records[tail & ring->mask];
+}
+
+static void commit_record(struct log_ring *ring) {
+	size_t tail = ring->tail + 1;
+	__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+	// wake the logging thread early when the ring gets half full, but only once
+	if (tail - __atomic_load_n(&ring->head, __ATOMIC_RELAXED) == (ring->mask + 1) / 2) {
+		pthread_cond_signal(&logger.wake);
+	}
+}
+
+void htt_log_access(const struct htt_access_entry *entry) {
+	if (logger.access_fd == -1) return;
+	struct log_ring *ring = get_ring();
+	if (!ring) return;
+	struct log_record *record = reserve_record(ring);
+	if (!record) return;
+
+	record->type = LOG_RECORD_ACCESS;
+	record->status = entry->status;
+	record->major_version = entry->major_version;
+	record->minor_version = entry->minor_version;
+	record->addr = entry->addr;
+	record->time = time(NULL);
+	record->bytes = entry->bytes;
+	record->latency_ns = entry->latency_ns;
+
+	record->method_len = entry->method ? entry->method_len : 0;
+	if (record->method_len > LOG_METHOD_MAX) record->method_len = LOG_METHOD_MAX;
+	if (record->method_len) memcpy(record->method, entry->method, record->method_len);
+
+	size_t path_len = strnlen(entry->path, LOG_TEXT_MAX - 1);
+	memcpy(record->text, entry->path, path_len);
+	record->text[path_len] = '\0';
+
+	commit_record(ring);
+}
+
+void htt_log_error(const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+
+	struct log_ring *ring = get_ring();
+	struct log_record *record;
+	if (!ring) {
+		vfprintf(stderr, fmt, args);
+		fputc('\n', stderr);
+	} else if ((record = reserve_record(ring))) {
+		record->type = LOG_RECORD_ERROR;
+		record->time = time(NULL);
+		vsnprintf(record->text, sizeof(record->text), fmt, args);
+		commit_record(ring);
+	}
+
+	va_end(args);
+}
+
+static void flush_buffer(struct write_buffer *out) {
+	size_t written = 0;
+	while (written < out->len) {
+		ssize_t res = write(out->fd, out->buf + written, out->len - written);
+		if (res == -1) {
+			if (errno == EINTR) continue;
+			break; // nowhere to report it, so the batch is lost
+		}
+		written += res;
+	}
+	out->len = 0;
+}
+
+static void append(struct write_buffer *out, const char *s, size_t len) {
+	if (out->len + len > sizeof(out->buf)) flush_buffer(out);
+	memcpy(out->buf + out->len, s, len);
+	out->len += len;
+}
+
+// quotes and unprintable characters are escaped, so a path can't fake log lines or fields
+static void append_escaped(struct write_buffer *out, const char *s, size_t len) {
+	for (size_t i = 0; i < len; ++i) {
+		unsigned char c = s[i];
+		if (c < 0x20 || c >= 0x7f || c == '"' || c == '\\') {
+			char esc[5];
+			snprintf(esc, sizeof(esc), "\\x%02x", c);
+			append(out, esc, 4);
+		} else {
+			append(out, s + i, 1);
+		}
+	}
+}
+
+// the time only changes once a second, so only format it that often
+static const char *log_time(time_t t) {
+	static time_t cached_time = -1;
+	static char cached[32];
+	if (t != cached_time) {
+		struct tm tm;
+		gmtime_r(&t, &tm);
+		strftime(cached, sizeof(cached), "%d/%b/%Y:%H:%M:%S +0000", &tm);
+		cached_time = t;
+	}
+	return cached;
+}
+
+// Common Log Format, with the latency added to the end
+static void format_access(struct write_buffer *out, const struct log_record *record) {
+	char addr[INET_ADDRSTRLEN];
+	struct in_addr in = { .s_addr = record->addr };
+	if (!inet_ntop(AF_INET, &in, addr, sizeof(addr))) strcpy(addr, "-");
+
+	char line[128];
+	int len = snprintf(line, sizeof(line), "%s - - [%s] \"", addr, log_time(record->time));
+	append(out, line, len);
+
+	if (record->method_len) {
+		append_escaped(out, record->method, record->method_len);
+		append(out, " ", 1);
+		append_escaped(out, record->text, strlen(record->text));
+		len = snprintf(line, sizeof(line), " HTTP/%d.%d\"", record->major_version, record->minor_version);
+		append(out, line, len);
+	} else {
+		append(out, "-\"", 2);
+	}
+
+	len = snprintf(line, sizeof(line), " %d %zu %luus\n", record->status, record->bytes,
+		(unsigned long) (record->latency_ns / 1000));
+	append(out, line, len);
+}
+
+static void format_error(struct write_buffer *out, const struct log_record *record) {
+	char line[64];
+	int len = snprintf(line, sizeof(line), "[%s] ", log_time(record->time));
+	append(out, line, len);
+	append(out, record->text, strlen(record->text));
+	append(out, "\n", 1);
+}
+
+static void drain(struct log_ring *rings, struct write_buffer *access, struct write_buffer *errors) {
+	for (struct log_ring *ring = rings; ring; ring = ring->next) {
+		size_t head = ring->head;
+		size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; ++head) {
+			const struct log_record *record = &ring->records[head & ring->mask];
+			if (record->type == LOG_RECORD_ACCESS) format_access(access, record);
+			else format_error(errors, record);
+
+			// give the space back as we go, in case the event loop is waiting for it
+			if (!(head & 63)) __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+		}
+		__atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+
+		size_t dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+		if (dropped != ring->dropped_reported) {
+			char line[96];
+			int len = snprintf(line, sizeof(line), "Log buffer full, dropped %zu records\n", dropped - ring->dropped_reported);
+			append(errors, line, len);
+			ring->dropped_reported = dropped;
+		}
+	}
+
+	if (access->len) flush_buffer(access);
+	if (errors->len) flush_buffer(errors);
+}
+
+static void *logger_main(void *arg) {
+	(void) arg;
+	static struct write_buffer access, errors;
+	access.fd = logger.access_fd;
+	errors.fd = STDERR_FILENO;
+
+	for (;;) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += FLUSH_INTERVAL_MS * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_nsec -= 1000000000L;
+			++deadline.tv_sec;
+		}
+
+		pthread_mutex_lock(&logger.lock);
+		pthread_cond_timedwait(&logger.wake, &logger.lock, &deadline);
+		struct log_ring *rings = logger.rings;
+		pthread_mutex_unlock(&logger.lock);
+
+		drain(rings, &access, &errors);
+	}
+
+	return NULL;
+}
+
+int htt_log_start(void) {
+	const char *path = global_config.access_log_path;
+	if (!path) {
+		logger.access_fd = -1;
+	} else if (!strcmp(path, "-")) {
+		logger.access_fd = STDOUT_FILENO;
+	} else {
+		logger.access_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+		if (logger.access_fd == -1) {
+			fprintf(stderr, "Failed to open access log %s: %s\n", path, strerror(errno));
+			return -1;
+		}
+	}
+
+	pthread_t thread;
+	int err = pthread_create(&thread, NULL, &logger_main, NULL);
+	if (err) {
+		fprintf(stderr, "Failed to start logging thread: %s\n", strerror(err));
+		return -1;
+	}
+	pthread_detach(thread);
+
+	__atomic_store_n(&logger.running, 1, __ATOMIC_RELEASE);
+	return 0;
+}
@@ -0,0 +1,58 @@
+/**
+ * @file access-log.h
+ * @author Will Brown
+ * @brief Asynchronous access and error log
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026 Will Brown
+ */
+
+#ifndef HTT_ACCESS_LOG_H
+#define HTT_ACCESS_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Everything that goes into one line of the access log
+ */
+struct htt_access_entry {
+    const char *method; ///< Method as it was sent, NULL if the request line couldn't be parsed
+    size_t method_len;
+    const char *path; ///< Path as it was sent
+    int major_version;
+    int minor_version;
+    int status;
+    uint32_t addr; ///< IPv4 address of the client, in network byte order
+    size_t bytes; ///< Bytes sent, including the header
+    uint64_t latency_ns; ///< Time from parsing the request to sending the last byte
+};
+
+/**
+ * @brief Open the access log and start the thread that writes the logs
+ * @details Every event loop gets its own ring buffer of records the first time it logs
+ * something, and the logging thread drains them all with batched writes. Nothing is formatted
+ * on the event loop. When a ring is full, records are either dropped and counted or the event
+ * loop waits for room, depending on the access_log_policy option. Until this is called,
+ * errors are written straight to stderr.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int htt_log_start(void);
+
+/**
+ * @brief Log a completed request, if the access log is enabled
+ *
+ * @param entry the request to log, strings are copied
+ */
+void htt_log_access(const struct htt_access_entry *entry);
+
+/**
+ * @brief Log an error to stderr
+ *
+ * @param fmt printf style format of the message, without a trailing newline
+ */
+void htt_log_error(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+#endif // HTT_ACCESS_LOG_H
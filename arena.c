@@ -0,0 +1,71 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdalign.h>
+
+#include "arena.h"
+
+// big enough for a request header buffer and everything a typical response needs
+#define ARENA_CHUNK_SIZE 16384
+
+static inline size_t align_up(size_t n) {
+	const size_t align = alignof(max_align_t);
+	return (n + align - 1) & ~(align - 1);
+}
+
+void *htt_arena_alloc(struct htt_arena *arena, size_t size) {
+	size = align_up(size ? size : 1);
+
+	struct htt_arena_chunk *chunk = arena->head;
+	if (!chunk || chunk->cap - chunk->used < size) {
+		size_t cap = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+		chunk = malloc(align_up(sizeof(*chunk)) + cap);
+		if (!chunk) return NULL;
+		chunk->prev = arena->head;
+		chunk->cap = cap;
+		chunk->used = 0;
+		arena->head = chunk;
+	}
+
+	void *p = (char *) chunk + align_up(sizeof(*chunk)) + chunk->used;
+	chunk->used += size;
+	return p;
+}
+
+char *htt_arena_strndup(struct htt_arena *arena, const char *s, size_t len) {
+	char *r = htt_arena_alloc(arena, len + 1);
+	if (!r) return NULL;
+	memcpy(r, s, len);
+	r[len] = '\0';
+	return r;
+}
+
+htt_arena_mark_t htt_arena_mark(const struct htt_arena *arena) {
+	return (htt_arena_mark_t) {
+		.chunk = arena->head,
+		.used = arena->head ? arena->head->used : 0
+	};
+}
+
+void htt_arena_release(struct htt_arena *arena, htt_arena_mark_t mark) {
+	while (arena->head && arena->head != mark.chunk) {
+		// keep the first chunk around, it will almost certainly be needed again
+		if (!arena->head->prev && !mark.chunk) break;
+		struct htt_arena_chunk *prev = arena->head->prev;
+		free(arena->head);
+		arena->head = prev;
+	}
+
+	if (arena->head) arena->head->used = arena->head == mark.chunk ? mark.used : 0;
+}
+
+void htt_arena_reset(struct htt_arena *arena) {
+	htt_arena_release(arena, (htt_arena_mark_t) { NULL, 0 });
+}
+
+void htt_arena_destroy(struct htt_arena *arena) {
+	while (arena->head) {
+		struct htt_arena_chunk *prev = arena->head->prev;
+		free(arena->head);
+		arena->head = prev;
+	}
+}
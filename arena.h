@@ -0,0 +1,93 @@
+/**
+ * @file arena.h
+ * @author Will Brown
+ * @brief Bump allocator for memory that lives as long as a request
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026 Will Brown
+ */
+
+#ifndef HTT_ARENA_H
+#define HTT_ARENA_H
+
+#include <stddef.h>
+
+/**
+ * @brief A block of memory that allocations are carved out of
+ */
+struct htt_arena_chunk {
+    struct htt_arena_chunk *prev; ///< Chunk that was filled before this one
+    size_t cap; ///< Usable size of the chunk
+    size_t used; ///< Number of bytes handed out
+    char data[];
+};
+
+/**
+ * @brief A bump allocator
+ * @details Individual allocations are never freed. Instead, everything allocated after
+ * a mark is released at once with htt_arena_release. The first chunk is kept when the
+ * arena is reset, so a reused arena doesn't need to call malloc at all for small requests.
+ */
+struct htt_arena {
+    struct htt_arena_chunk *head; ///< Chunk currently being allocated from
+};
+
+/**
+ * @brief A position in an arena to release back to
+ */
+typedef struct {
+    struct htt_arena_chunk *chunk;
+    size_t used;
+} htt_arena_mark_t;
+
+/**
+ * @brief Allocate memory from an arena
+ *
+ * @param arena the arena to allocate from
+ * @param size number of bytes to allocate
+ * @return pointer to the memory (aligned for any type), or NULL on failure
+ */
+void *htt_arena_alloc(struct htt_arena *arena, size_t size);
+
+/**
+ * @brief Copy a string into an arena
+ *
+ * @param arena the arena to allocate from
+ * @param s the string to copy
+ * @param len length of the string, not including the null terminator
+ * @return the copy, or NULL on failure
+ */
+char *htt_arena_strndup(struct htt_arena *arena, const char *s, size_t len);
+
+/**
+ * @brief Get the current position of an arena
+ *
+ * @param arena the arena to mark
+ * @return the mark
+ */
+htt_arena_mark_t htt_arena_mark(const struct htt_arena *arena);
+
+/**
+ * @brief Release everything allocated after a mark
+ *
+ * @param arena the arena to release memory from
+ * @param mark a mark taken from this arena
+ */
+void htt_arena_release(struct htt_arena *arena, htt_arena_mark_t mark);
+
+/**
+ * @brief Release everything in an arena, keeping its first chunk for reuse
+ *
+ * @param arena the arena to reset
+ */
+void htt_arena_reset(struct htt_arena *arena);
+
+/**
+ * @brief Free all memory owned by an arena
+ *
+ * @param arena the arena to destroy
+ */
+void htt_arena_destroy(struct htt_arena *arena);
+
+#endif // HTT_ARENA_H
@@ -0,0 +1,98 @@
+/**
+ * @file histogram.h
+ * @author Will Brown
+ * @brief Latency histogram shared by the benchmarks
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026 Will Brown
+ */
+
+#ifndef BENCH_HISTOGRAM_H
+#define BENCH_HISTOGRAM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+// each power of two is split into this many linear buckets, so values are within ~3%
+#define HISTOGRAM_SUB_BITS 5
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+/**
+ * @brief Log-linear histogram of nanosecond values
+ */
+struct histogram {
+    uint64_t count; ///< Number of recorded values
+    uint64_t max; ///< Largest recorded value
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+static inline uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline unsigned histogram_index(uint64_t v) {
+	if (v < HISTOGRAM_SUB_BUCKETS) return v;
+	unsigned exp = 63 - __builtin_clzll(v);
+	unsigned shift = exp - HISTOGRAM_SUB_BITS;
+	return (shift + 1) * HISTOGRAM_SUB_BUCKETS + ((v >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+// Returns the largest value that falls in a bucket
+static inline uint64_t histogram_value(unsigned index) {
+	if (index < HISTOGRAM_SUB_BUCKETS) return index;
+	unsigned shift = index / HISTOGRAM_SUB_BUCKETS - 1;
+	uint64_t base = (uint64_t) (HISTOGRAM_SUB_BUCKETS + index % HISTOGRAM_SUB_BUCKETS) << shift;
+	return base + ((uint64_t) 1 << shift) - 1;
+}
+
+static inline void histogram_record(struct histogram *h, uint64_t v) {
+	++h->buckets[histogram_index(v)];
+	++h->count;
+	if (v > h->max) h->max = v;
+}
+
+static inline void histogram_merge(struct histogram *dst, const struct histogram *src) {
+	for (unsigned i = 0; i < HISTOGRAM_BUCKETS; ++i) dst->buckets[i] += src->buckets[i];
+	dst->count += src->count;
+	if (src->max > dst->max) dst->max = src->max;
+}
+
+// q is a fraction, e.g. 0.99 for p99
+static inline uint64_t histogram_quantile(const struct histogram *h, double q) {
+	if (!h->count) return 0;
+	uint64_t rank = (uint64_t) (q * h->count);
+	if (rank >= h->count) rank = h->count - 1;
+
+	uint64_t seen = 0;
+	for (unsigned i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+		seen += h->buckets[i];
+		if (seen > rank) {
+			uint64_t v = histogram_value(i);
+			return v < h->max ? v : h->max;
+		}
+	}
+	return h->max;
+}
+
+// print p50/p99/p999/max in microseconds, or nanoseconds if they're tiny
+static inline void histogram_print(const struct histogram *h, FILE *fp) {
+	const double quantiles[] = { 0.5, 0.99, 0.999 };
+	const char *names[] = { "p50", "p99", "p999" };
+	int micro = histogram_quantile(h, 0.5) >= 10000;
+
+	for (int i = 0; i < 3; ++i) {
+		uint64_t v = histogram_quantile(h, quantiles[i]);
+		if (micro) fprintf(fp, "%s %.1fus  ", names[i], v / 1000.0);
+		else fprintf(fp, "%s %luns  ", names[i], (unsigned long) v);
+	}
+	if (micro) fprintf(fp, "max %.1fus\n", h->max / 1000.0);
+	else fprintf(fp, "max %luns\n", (unsigned long) h->max);
+}
+
+#endif // BENCH_HISTOGRAM_H
@@ -0,0 +1,458 @@
+/*
+ * Closed-loop HTTP load generator.
+ * Each connection has one request in flight at a time, and every thread runs its own
+ * epoll loop over its share of the connections. Paths are picked from a weighted mix
+ * with a fixed seed, so runs with the same options send the same requests.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "histogram.h"
+
+#define MAX_TARGETS 64
+#define MAX_EVENTS 128
+#define RECV_BUFFER_SIZE 65536
+
+struct target {
+	const char *path;
+	unsigned weight;
+	char *request; ///< Complete request, rendered up front
+	size_t request_len;
+};
+
+static struct {
+	struct sockaddr_in addr;
+	unsigned connections;
+	unsigned threads;
+	unsigned duration;
+	unsigned warmup;
+	int keepalive;
+	uint64_t seed;
+	struct target targets[MAX_TARGETS];
+	unsigned target_count;
+	unsigned total_weight;
+} opts = {
+	.connections = 64,
+	.threads = 1,
+	.duration = 10,
+	.warmup = 2,
+	.keepalive = 1,
+	.seed = 1
+};
+
+enum client_state { CLIENT_CONNECTING, CLIENT_SENDING, CLIENT_RECEIVING };
+
+struct client {
+	int fd;
+	uint32_t events; ///< Events currently registered with epoll
+	enum client_state state;
+	const struct target *target;
+	size_t sent;
+	uint64_t start; ///< When the current request was started, including any connect
+	size_t header_len; ///< Bytes of response header seen so far, until it is complete
+	int header_done;
+	int server_close; ///< The server said it will close the connection after this response
+	size_t body_left;
+	char header[1024]; ///< Start of the response, only as much as is needed to parse it
+};
+
+struct worker {
+	pthread_t thread;
+	uint64_t rng;
+	struct client *clients;
+	unsigned client_count;
+	int epollfd;
+	volatile int *recording;
+	volatile int *stop;
+	struct histogram latency;
+	uint64_t requests;
+	uint64_t errors;
+	uint64_t bad_status;
+	uint64_t bytes;
+};
+
+// xorshift64*, plenty for picking paths
+static uint64_t next_random(uint64_t *state) {
+	uint64_t x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+static const struct target *pick_target(struct worker *w) {
+	unsigned r = next_random(&w->rng) % opts.total_weight;
+	for (unsigned i = 0; i < opts.target_count; ++i) {
+		if (r < opts.targets[i].weight) return &opts.targets[i];
+		r -= opts.targets[i].weight;
+	}
+	return &opts.targets[0];
+}
+
+static int set_interest(struct worker *w, struct client *c, uint32_t events, int op) {
+	if (op == EPOLL_CTL_MOD && c->events == events) return 0;
+	c->events = events;
+	struct epoll_event ev = { .events = events, .data.ptr = c };
+	return epoll_ctl(w->epollfd, op, c->fd, &ev);
+}
+
+static void start_request(struct client *c, struct worker *w) {
+	c->target = pick_target(w);
+	c->sent = 0;
+	c->header_len = 0;
+	c->header_done = 0;
+	c->server_close = 0;
+	c->body_left = 0;
+}
+
+static int open_connection(struct worker *w, struct client *c) {
+	c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (c->fd == -1) return -1;
+
+	int one = 1;
+	setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	c->state = CLIENT_CONNECTING;
+	if (connect(c->fd, (struct sockaddr *) &opts.addr, sizeof(opts.addr)) == -1 && errno != EINPROGRESS) {
+		close(c->fd);
+		c->fd = -1;
+		return -1;
+	}
+	return set_interest(w, c, EPOLLOUT, EPOLL_CTL_ADD);
+}
+
+static void handle_writable(struct worker *w, struct client *c);
+
+// start the next request on a client, reconnecting if the last connection can't be reused
+static void next_request(struct worker *w, struct client *c, int reconnect) {
+	start_request(c, w);
+	c->start = now_ns();
+
+	if (reconnect) {
+		if (c->fd != -1) close(c->fd);
+		if (open_connection(w, c)) ++w->errors;
+	} else {
+		// the socket is almost certainly writable, so don't wait for epoll to say so
+		c->state = CLIENT_SENDING;
+		handle_writable(w, c);
+	}
+}
+
+static void fail(struct worker *w, struct client *c) {
+	if (*w->recording) ++w->errors;
+	next_request(w, c, 1);
+}
+
+// Returns 0 once the header is complete, 1 if more is needed, -1 if it is malformed
+static int parse_response_header(struct client *c, const char *data, size_t len, size_t *used) {
+	size_t n = len;
+	if (n > sizeof(c->header) - 1 - c->header_len) n = sizeof(c->header) - 1 - c->header_len;
+	memcpy(c->header + c->header_len, data, n);
+	size_t old_len = c->header_len;
+	c->header_len += n;
+	c->header[c->header_len] = '\0';
+
+	char *end = strstr(c->header, "\r\n\r\n");
+	if (!end) {
+		*used = n;
+		return c->header_len == sizeof(c->header) - 1 ? -1 : 1;
+	}
+	*used = end + 4 - c->header - old_len;
+	*end = '\0';
+
+	int status;
+	if (sscanf(c->header, "HTTP/%*d.%*d %d", &status) != 1) return -1;
+	c->server_close = !opts.keepalive || !strncmp(c->header, "HTTP/1.0", 8);
+
+	// only the headers that matter for framing
+	for (char *line = strstr(c->header, "\r\n"); line; line = strstr(line, "\r\n")) {
+		line += 2;
+		if (!strncasecmp(line, "Content-Length:", 15)) c->body_left = strtoull(line + 15, NULL, 10);
+		else if (!strncasecmp(line, "Connection:", 11)) c->server_close = !!strcasestr(line, "close");
+	}
+
+	c->header_done = status;
+	return 0;
+}
+
+static void finish_response(struct worker *w, struct client *c) {
+	if (*w->recording) {
+		histogram_record(&w->latency, now_ns() - c->start);
+		++w->requests;
+		if (c->header_done >= 400) ++w->bad_status;
+	}
+	next_request(w, c, c->server_close);
+}
+
+static void handle_readable(struct worker *w, struct client *c) {
+	static _Thread_local char buf[RECV_BUFFER_SIZE];
+	for (;;) {
+		ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+		if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+		if (n <= 0) {
+			fail(w, c);
+			return;
+		}
+		if (*w->recording) w->bytes += n;
+
+		size_t off = 0;
+		if (!c->header_done) {
+			size_t used;
+			int res = parse_response_header(c, buf, n, &used);
+			if (res == -1) {
+				fail(w, c);
+				return;
+			} else if (res == 1) continue;
+			off = used;
+		}
+
+		size_t body = n - off;
+		if (body > c->body_left) {
+			// one request at a time, so the server has no business sending more
+			fail(w, c);
+			return;
+		}
+		c->body_left -= body;
+		if (!c->body_left) {
+			finish_response(w, c);
+			return;
+		}
+	}
+}
+
+static void handle_writable(struct worker *w, struct client *c) {
+	if (c->state == CLIENT_CONNECTING) {
+		int err = 0;
+		socklen_t len = sizeof(err);
+		if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err) {
+			fail(w, c);
+			return;
+		}
+		c->state = CLIENT_SENDING;
+	}
+
+	const struct target *t = c->target;
+	while (c->sent < t->request_len) {
+		ssize_t n = send(c->fd, t->request + c->sent, t->request_len - c->sent, MSG_NOSIGNAL);
+		if (n == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				set_interest(w, c, EPOLLOUT, EPOLL_CTL_MOD);
+				return;
+			}
+			fail(w, c);
+			return;
+		}
+		c->sent += n;
+	}
+
+	c->state = CLIENT_RECEIVING;
+	set_interest(w, c, EPOLLIN, EPOLL_CTL_MOD);
+}
+
+static void *worker_main(void *arg) {
+	struct worker *w = arg;
+
+	for (unsigned i = 0; i < w->client_count; ++i) {
+		struct client *c = &w->clients[i];
+		c->fd = -1;
+		next_request(w, c, 1);
+	}
+
+	struct epoll_event events[MAX_EVENTS];
+	while (!*w->stop) {
+		int n = epoll_wait(w->epollfd, events, MAX_EVENTS, 100);
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			fprintf(stderr, "epoll_wait failed: %s\n", strerror(errno));
+			exit(1);
+		}
+
+		for (int i = 0; i < n; ++i) {
+			struct client *c = events[i].data.ptr;
+			if (c->state == CLIENT_RECEIVING) handle_readable(w, c);
+			else if (events[i].events & (EPOLLERR | EPOLLHUP) && c->state == CLIENT_CONNECTING) fail(w, c);
+			else handle_writable(w, c);
+		}
+	}
+
+	for (unsigned i = 0; i < w->client_count; ++i) {
+		if (w->clients[i].fd != -1) close(w->clients[i].fd);
+	}
+	return NULL;
+}
+
+static int add_target(const char *arg) {
+	if (opts.target_count == MAX_TARGETS) {
+		fprintf(stderr, "Too many paths, the limit is %d\n", MAX_TARGETS);
+		return -1;
+	}
+
+	struct target *t = &opts.targets[opts.target_count];
+	char *path = strdup(arg);
+	char *colon = strrchr(path, ':');
+	t->weight = 1;
+	if (colon) {
+		*colon = '\0';
+		char *end;
+		unsigned long weight = strtoul(colon + 1, &end, 10);
+		if (*end || !weight) {
+			fprintf(stderr, "Invalid weight in %s\n", arg);
+			free(path);
+			return -1;
+		}
+		t->weight = weight;
+	}
+	if (*path != '/') {
+		fprintf(stderr, "Paths must start with /: %s\n", arg);
+		free(path);
+		return -1;
+	}
+
+	t->path = path;
+	++opts.target_count;
+	opts.total_weight += t->weight;
+	return 0;
+}
+
+static void render_requests(const char *host) {
+	for (unsigned i = 0; i < opts.target_count; ++i) {
+		struct target *t = &opts.targets[i];
+		int len = asprintf(&t->request, "GET %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: htt-loadgen\r\n%s\r\n",
+			t->path, host, opts.keepalive ? "" : "Connection: close\r\n");
+		if (len == -1) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+		t->request_len = len;
+	}
+}
+
+static void usage(const char *name) {
+	fprintf(stderr,
+		"Usage: %s [options] [path[:weight]]...\n"
+		"  -a addr      server address (default 127.0.0.1)\n"
+		"  -p port      server port (default 8000)\n"
+		"  -c conns     concurrent connections (default 64)\n"
+		"  -t threads   client threads (default 1)\n"
+		"  -d seconds   measured duration (default 10)\n"
+		"  -w seconds   warmup before measuring (default 2)\n"
+		"  -n           no keep-alive, open a new connection for every request\n"
+		"  -s seed      seed for picking paths (default 1)\n"
+		"Paths are picked in proportion to their weight, / is used if none are given.\n",
+		name);
+}
+
+int main(int argc, char *argv[]) {
+	const char *host = "127.0.0.1";
+	unsigned short port = 8000;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "a:p:c:t:d:w:ns:h")) != -1) {
+		switch (opt) {
+			case 'a': host = optarg; break;
+			case 'p': port = atoi(optarg); break;
+			case 'c': opts.connections = atoi(optarg); break;
+			case 't': opts.threads = atoi(optarg); break;
+			case 'd': opts.duration = atoi(optarg); break;
+			case 'w': opts.warmup = atoi(optarg); break;
+			case 'n': opts.keepalive = 0; break;
+			case 's': opts.seed = strtoull(optarg, NULL, 0); break;
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	for (int i = optind; i < argc; ++i) {
+		if (add_target(argv[i])) return 1;
+	}
+	if (!opts.target_count) add_target("/");
+
+	if (!opts.connections || !opts.threads || !opts.duration) {
+		fprintf(stderr, "Connections, threads and duration must be positive\n");
+		return 1;
+	}
+	if (opts.threads > opts.connections) opts.threads = opts.connections;
+
+	opts.addr.sin_family = AF_INET;
+	opts.addr.sin_port = htons(port);
+	if (inet_pton(AF_INET, host, &opts.addr.sin_addr) != 1) {
+		fprintf(stderr, "Invalid address: %s\n", host);
+		return 1;
+	}
+	render_requests(host);
+
+	volatile int recording = 0, stop = 0;
+	struct worker *workers = calloc(opts.threads, sizeof(*workers));
+	struct client *clients = calloc(opts.connections, sizeof(*clients));
+	if (!workers || !clients) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	for (unsigned i = 0, first = 0; i < opts.threads; ++i) {
+		struct worker *w = &workers[i];
+		w->client_count = opts.connections / opts.threads + (i < opts.connections % opts.threads);
+		w->clients = clients + first;
+		first += w->client_count;
+		// xorshift gets stuck on 0
+		w->rng = (opts.seed + i) * 0x9E3779B97F4A7C15ULL | 1;
+		w->recording = &recording;
+		w->stop = &stop;
+		w->epollfd = epoll_create1(EPOLL_CLOEXEC);
+		if (w->epollfd == -1) {
+			fprintf(stderr, "Failed to create epoll instance: %s\n", strerror(errno));
+			return 1;
+		}
+		int err = pthread_create(&w->thread, NULL, &worker_main, w);
+		if (err) {
+			fprintf(stderr, "Failed to start thread: %s\n", strerror(err));
+			return 1;
+		}
+	}
+
+	sleep(opts.warmup);
+	uint64_t start = now_ns();
+	recording = 1;
+	sleep(opts.duration);
+	recording = 0;
+	double elapsed = (now_ns() - start) / 1e9;
+	stop = 1;
+
+	struct histogram latency = {0};
+	uint64_t requests = 0, errors = 0, bad_status = 0, bytes = 0;
+	for (unsigned i = 0; i < opts.threads; ++i) {
+		pthread_join(workers[i].thread, NULL);
+		histogram_merge(&latency, &workers[i].latency);
+		requests += workers[i].requests;
+		errors += workers[i].errors;
+		bad_status += workers[i].bad_status;
+		bytes += workers[i].bytes;
+	}
+
+	printf("%u connections, %u threads, %s, %.2fs\n", opts.connections, opts.threads,
+		opts.keepalive ? "keep-alive" : "no keep-alive", elapsed);
+	printf("requests %lu  errors %lu  status>=400 %lu\n",
+		(unsigned long) requests, (unsigned long) errors, (unsigned long) bad_status);
+	printf("throughput %.0f req/s  %.2f MB/s\n", requests / elapsed, bytes / elapsed / 1e6);
+	printf("latency ");
+	histogram_print(&latency, stdout);
+	return errors ? 2 : 0;
+}
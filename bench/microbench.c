@@ -0,0 +1,296 @@
+/*
+ * Microbenchmarks for the hot parts of request handling.
+ * http.c is included directly so its static functions can be called. Run this from the
+ * root of the repository, since it serves files and MIME types from the working directory
+ * the same way the server does.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../http.c"
+#include "../trie.h"
+
+#include "histogram.h"
+
+// operations per timed batch, so the clock isn't read for every single one
+#define BATCH 64
+#define WARMUP_NS 200000000ULL
+#define RUN_NS 1000000000ULL
+
+typedef void (*bench_func_t)(void *ctx, unsigned i);
+
+static void run_bench(const char *name, bench_func_t func, void *ctx) {
+	struct histogram h = {0};
+	uint64_t ops = 0;
+	unsigned i = 0;
+
+	for (uint64_t start = now_ns(); now_ns() - start < WARMUP_NS;) {
+		for (int j = 0; j < BATCH; ++j) func(ctx, i++);
+	}
+
+	uint64_t start = now_ns(), now = start;
+	while (now - start < RUN_NS) {
+		uint64_t batch_start = now;
+		for (int j = 0; j < BATCH; ++j) func(ctx, i++);
+		now = now_ns();
+		histogram_record(&h, (now - batch_start) / BATCH);
+		ops += BATCH;
+	}
+
+	printf("%-36s %11.0f ops/s  ", name, ops / ((now - start) / 1e9));
+	histogram_print(&h, stdout);
+	fflush(stdout);
+}
+
+/* parse_http_request */
+
+static const char BROWSER_REQUEST[] =
+	"GET /assets/css/style.css?v=1697040000 HTTP/1.1\r\n"
+	"Host: localhost:8000\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:118.0) Gecko/20100101 Firefox/118.0\r\n"
+	"Accept: text/css,*/*;q=0.1\r\n"
+	"Accept-Language: en-US,en;q=0.5\r\n"
+	"Accept-Encoding: gzip, deflate, br\r\n"
+	"Connection: keep-alive\r\n"
+	"Referer: http://localhost:8000/\r\n"
+	"Sec-Fetch-Dest: style\r\n"
+	"Sec-Fetch-Mode: no-cors\r\n"
+	"Sec-Fetch-Site: same-origin\r\n"
+	"If-Modified-Since: Wed, 11 Oct 2023 16:00:00 GMT\r\n"
+	"\r\n";
+
+static const char MINIMAL_REQUEST[] = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+struct parse_request_ctx {
+	const char *request;
+	size_t len;
+	char buf[HTTP_HEADER_MAX];
+};
+
+static void bench_parse_http_request(void *arg, unsigned i) {
+	(void) i;
+	struct parse_request_ctx *ctx = arg;
+	// parsing splits the buffer up in place, so it needs a fresh copy every time
+	memcpy(ctx->buf, ctx->request, ctx->len);
+	ctx->buf[ctx->len - 2] = '\0';
+	struct http_request req;
+	parse_http_request(&req, ctx->buf, ctx->len - 2);
+	__asm__ volatile("" : : "r"(&req) : "memory");
+}
+
+/* parse_uri */
+
+struct parse_uri_ctx {
+	const char *path;
+	struct htt_arena arena;
+	char buf[HTTP_PATH_MAX];
+};
+
+static void bench_parse_uri(void *arg, unsigned i) {
+	(void) i;
+	struct parse_uri_ctx *ctx = arg;
+	htt_arena_mark_t mark = htt_arena_mark(&ctx->arena);
+	strcpy(ctx->buf, ctx->path);
+	struct URI uri = parse_uri(ctx->buf, &ctx->arena);
+	__asm__ volatile("" : : "r"(&uri) : "memory");
+	// resolving the path opens the file, unless it came from the path cache
+	if (uri.fd != -1) close(uri.fd);
+	htt_arena_release(&ctx->arena, mark);
+}
+
+/* decode_percent_encoding */
+
+struct decode_ctx {
+	const char *uri;
+	char buf[HTTP_PATH_MAX];
+};
+
+static void bench_decode_percent_encoding(void *arg, unsigned i) {
+	(void) i;
+	struct decode_ctx *ctx = arg;
+	char *res = decode_percent_encoding(ctx->uri, ctx->buf, NULL);
+	__asm__ volatile("" : : "r"(res) : "memory");
+}
+
+/* htt_trie_search and htt_flat_trie_search */
+
+static const char *EXTENSIONS[] = {
+	"html", "css", "js", "png", "jpg", "svg", "json", "woff2", "txt", "notanextension"
+};
+#define EXTENSION_COUNT (sizeof(EXTENSIONS) / sizeof(EXTENSIONS[0]))
+
+static void bench_trie_search(void *arg, unsigned i) {
+	char *res = htt_trie_search(arg, EXTENSIONS[i % EXTENSION_COUNT]);
+	__asm__ volatile("" : : "r"(res) : "memory");
+}
+
+static void bench_flat_trie_search(void *arg, unsigned i) {
+	char *res = htt_flat_trie_search(arg, EXTENSIONS[i % EXTENSION_COUNT]);
+	__asm__ volatile("" : : "r"(res) : "memory");
+}
+
+/* lookup_mime_type */
+
+static void bench_lookup_mime_type(void *arg, unsigned i) {
+	(void) arg;
+	const char *res = lookup_mime_type(EXTENSIONS[i % EXTENSION_COUNT]);
+	__asm__ volatile("" : : "r"(res) : "memory");
+}
+
+/* create_header */
+
+struct create_header_ctx {
+	struct http_response *res;
+	struct htt_arena *arena;
+};
+
+static void bench_create_header(void *arg, unsigned i) {
+	(void) i;
+	struct create_header_ctx *ctx = arg;
+	htt_arena_mark_t mark = htt_arena_mark(ctx->arena);
+	create_header(ctx->res, ctx->arena);
+	__asm__ volatile("" : : "r"(ctx->res->header_buf) : "memory");
+	htt_arena_release(ctx->arena, mark);
+}
+
+static struct http_response *make_response(const char *request, struct htt_arena *arena) {
+	static char buf[HTTP_HEADER_MAX];
+	size_t len = strlen(request);
+	memcpy(buf, request, len);
+	buf[len - 2] = '\0';
+	struct http_request req;
+	parse_http_request(&req, buf, len - 2);
+	struct http_response *res = create_response(&req, arena);
+	if (!res) {
+		fprintf(stderr, "Failed to create a response for the create_header benchmark\n");
+		exit(1);
+	}
+	return res;
+}
+
+int main(void) {
+	load_default_config();
+	load_mime_type_list();
+	if (http_init()) return 1;
+
+	{
+		struct parse_request_ctx ctx = { .request = BROWSER_REQUEST, .len = sizeof(BROWSER_REQUEST) - 1 };
+		run_bench("parse_http_request (browser)", &bench_parse_http_request, &ctx);
+		ctx = (struct parse_request_ctx) { .request = MINIMAL_REQUEST, .len = sizeof(MINIMAL_REQUEST) - 1 };
+		run_bench("parse_http_request (minimal)", &bench_parse_http_request, &ctx);
+	}
+
+	{
+		static const char *PATHS[][2] = {
+			{ "/index.html", "file" },
+			{ "/", "directory index" },
+			{ "/no/such/file%20here.html?query=1", "missing" }
+		};
+		// the path cache is only set up on first use, so it stays off until it is turned back on
+		size_t path_cache_size = global_config.path_cache_size;
+		struct parse_uri_ctx ctx = {0};
+		char name[64];
+		for (int cached = 0; cached < 2; ++cached) {
+			global_config.path_cache_size = cached ? path_cache_size : 0;
+			for (size_t i = 0; i < sizeof(PATHS) / sizeof(PATHS[0]); ++i) {
+				ctx.path = PATHS[i][0];
+				snprintf(name, sizeof(name), "parse_uri (%s, %s)", PATHS[i][1], cached ? "cached" : "uncached");
+				run_bench(name, &bench_parse_uri, &ctx);
+			}
+		}
+		htt_arena_destroy(&ctx.arena);
+	}
+
+	{
+		struct decode_ctx ctx = { .uri = "plain/path/without/escapes/index.html" };
+		run_bench("decode_percent_encoding (plain)", &bench_decode_percent_encoding, &ctx);
+		ctx.uri = "some%20dir/with%20a%20few%2Fescapes%3F/and%26more.html";
+		run_bench("decode_percent_encoding (escaped)", &bench_decode_percent_encoding, &ctx);
+	}
+
+	{
+		// the same list the server is built with, in a trie of our own
+		struct htt_trie *trie = htt_trie_create();
+		FILE *fp = fopen("mime-types.txt", "r");
+		if (!trie || !fp) {
+			fprintf(stderr, "Failed to load mime-types.txt\n");
+			return 1;
+		}
+		char *key, *value;
+		while (fscanf(fp, "%m[^=]=%ms\n", &key, &value) == 2) {
+			htt_trie_insert(trie, key, value);
+			free(key);
+		}
+		fclose(fp);
+
+		run_bench("htt_trie_search", &bench_trie_search, trie);
+
+		struct htt_flat_trie *flat = htt_trie_freeze(trie);
+		if (!flat) {
+			fprintf(stderr, "Failed to freeze the trie\n");
+			return 1;
+		}
+		run_bench("htt_flat_trie_search", &bench_flat_trie_search, flat);
+		htt_flat_trie_destroy(flat);
+	}
+
+	run_bench("lookup_mime_type", &bench_lookup_mime_type, NULL);
+
+	{
+		struct htt_arena arena = {0};
+		struct create_header_ctx ctx = {
+			.res = make_response("GET /index.html HTTP/1.1\r\n\r\n", &arena),
+			.arena = &arena
+		};
+		// the second request for a file is served from the cache, with a pre-rendered header
+		destroy_response(ctx.res);
+		ctx.res = make_response("GET /index.html HTTP/1.1\r\n\r\n", &arena);
+		run_bench("create_header (cached file)", &bench_create_header, &ctx);
+		destroy_response(ctx.res);
+
+		ctx.res = make_response("GET /no-such-file HTTP/1.1\r\n\r\n", &arena);
+		run_bench("create_header (404)", &bench_create_header, &ctx);
+		destroy_response(ctx.res);
+		htt_arena_destroy(&arena);
+	}
+
+	{
+		// a file deleted while its path is cached has to turn into a 404 rather than a 500.
+		// It is too big for the file cache, so the second response has to open it again.
+		const char *path = "bench/www/.deleted-while-cached.bin";
+		FILE *fp = fopen(path, "w");
+		if (!fp) {
+			fprintf(stderr, "Failed to create %s\n", path);
+			return 1;
+		}
+		for (size_t written = 0; written <= global_config.cache_max_file_size; written += 4096) {
+			static const char block[4096];
+			fwrite(block, 1, sizeof(block), fp);
+		}
+		fclose(fp);
+
+		struct htt_arena arena = {0};
+		struct http_response *res = make_response("GET /bench/www/.deleted-while-cached.bin HTTP/1.1\r\n\r\n", &arena);
+		int first = res->status;
+		destroy_response(res);
+		unlink(path);
+		res = make_response("GET /bench/www/.deleted-while-cached.bin HTTP/1.1\r\n\r\n", &arena);
+		int second = res->status;
+		destroy_response(res);
+		res = make_response("GET /bench/www/.deleted-while-cached.bin HTTP/1.1\r\n\r\n", &arena);
+		int third = res->status;
+		destroy_response(res);
+		htt_arena_destroy(&arena);
+
+		printf("%-36s %d, then %d and %d once deleted\n", "create_response (deleted file)", first, second, third);
+		if (first != 200 || second != 404 || third != 404) {
+			fprintf(stderr, "A deleted file that was in the path cache should be a 404\n");
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -1,71 +1,293 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
+#include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/epoll.h>
 
+#include "access-log.h"
 #include "callback.h"
+#include "config.h"
 #include "connection.h"
 #include "http.h"
+#include "metrics.h"
+
+// every response ends up here once, whether it was sent completely or not
+static void log_response(const htt_connection_t *conn, const struct http_response *res) {
+	htt_metrics_count_status(res->status);
+	htt_metrics_add(HTT_METRIC_BYTES_SENT, res->header_sent + res->content_sent);
+	
+	struct htt_access_entry entry = {
+		.method = res->method,
+		.method_len = res->method_len,
+		.path = res->request_path,
+		.major_version = res->request_major_version,
+		.minor_version = res->request_minor_version,
+		.status = res->status,
+		.addr = conn->peer_addr,
+		.bytes = res->header_sent + res->content_sent,
+		.latency_ns = htt_metrics_now() - res->start_ns
+	};
+	htt_log_access(&entry);
+}
+
+// hand the connection back to http_request_callback, or close it if it isn't persistent.
+// Returns 1 if the connection is waiting for another request, 0 if it was closed.
+static int finish_response(htt_connection_t *conn) {
+	struct http_response *res = conn->data;
+	struct sized_buffer *header = res->request_buf;
+	htt_metrics_observe(HTT_STAGE_BODY_SEND, htt_metrics_now() - res->send_start_ns);
+	log_response(conn, res);
+	enum connection_type connection = res->connection;
+	destroy_response(res);
+	consume_http_header(header);
+	
+	// a client that has shut down its side won't send another request, unless it's already here
+	if (connection != CONN_KEEPALIVE || (conn->read_closed && !header->len && !htt_connection_has_input(conn))) {
+		htt_connection_close(conn);
+		return 0;
+	}
+	
+	header->recv_start_ns = htt_metrics_now();
+	conn->data = header;
+	conn->callback = &http_request_callback;
+	conn->free_func = NULL;
+	if (htt_connection_set_events(conn, EPOLLIN | EPOLLRDHUP)) {
+		htt_connection_close(conn);
+		return 0;
+	}
+	
+	// an idle connection gets the keep-alive timeout, a partially received request the header timeout
+	htt_connection_set_timeout(conn, header->len ? global_config.header_timeout : global_config.keepalive_timeout);
+	return 1;
+}
+
+static int send_header(htt_connection_t *conn);
 
 int http_request_callback(htt_connection_t *conn) {
 	struct sized_buffer *header = conn->data;
-	int recv_res = recv_http_header(conn->fd, header);
-	if (recv_res) {
-		struct http_request req = recv_res == 1 ?
-			parse_http_request(header->buf) :
-			(struct http_request) { .error = 400 };
-		free(header);
-		conn->data = create_response(&req);
-		if (!conn->data) {
+	
+	// pipelined requests are handled in a loop, since no event will arrive for them
+	do {
+		size_t prev_len = header->len;
+		if (!prev_len) header->recv_start_ns = htt_metrics_now();
+		int recv_res = recv_http_header(conn, header);
+		if (recv_res == -2) {
+			htt_connection_close(conn);
+			return 0;
+		} else if (!recv_res) {
+			// the first bytes of a new request start the clock on the rest of the header
+			if (!prev_len && header->len) htt_connection_set_timeout(conn, global_config.header_timeout);
+			return 0;
+		}
+		
+		uint64_t start_ns = htt_metrics_now();
+		struct http_request req = { .path = "", .error = 400 };
+		if (recv_res == 1) {
+			htt_metrics_observe(HTT_STAGE_HEADER_RECV, start_ns - header->recv_start_ns);
+			parse_http_request(&req, header->buf, header->req_len - 2);
+		}
+		uint64_t parsed_ns = htt_metrics_now();
+		if (recv_res == 1) htt_metrics_observe(HTT_STAGE_PARSE_REQUEST, parsed_ns - start_ns);
+		struct http_response *res = create_response(&req, &conn->arena);
+		uint64_t created_ns = htt_metrics_now();
+		htt_metrics_observe(HTT_STAGE_CREATE_RESPONSE, created_ns - parsed_ns);
+		if (!res) {
 			htt_connection_close(conn);
 			return -1;
+		}
+		
+		res->request_buf = header;
+		res->start_ns = start_ns;
+		res->send_start_ns = created_ns;
+		conn->data = res;
+		conn->free_func = (htt_free_t) &destroy_response;
+		htt_connection_set_timeout(conn, global_config.send_timeout);
+		
+		// most responses fit in the socket buffer, so only wait for EPOLLOUT once a send would block
+		if (send_header(conn) != 1) return 0;
+	} while (header->len);
+	
+	return 0;
+}
+
+// the body of the response if it is held in memory, NULL if it is sent from a file
+static const char *memory_content(const struct http_response *res) {
+	if (res->cache_entry) return res->cache_entry->data + res->content_offset;
+	if (res->file_map) return res->file_map->data + res->content_offset;
+	return res->content_buf ? res->content_buf + res->content_offset : NULL;
+}
+
+// wait until the socket is writable again, then carry on with callback
+static int wait_writable(htt_connection_t *conn, htt_callback_t callback) {
+	conn->callback = callback;
+	if (htt_connection_set_events(conn, EPOLLOUT)) {
+		destroy_response(conn->data);
+		htt_connection_close(conn);
+		return -1;
+	}
+	return 0;
+}
+
+static int send_content(htt_connection_t *conn);
+
+// Returns 1 if the response was finished and the connection is waiting for another request,
+// 0 if the connection is waiting for the socket to become writable, -1 if it was closed.
+static int send_header(htt_connection_t *conn) {
+	struct http_response *res = conn->data;
+	const char *content = memory_content(res);
+	size_t prev_sent = res->header_sent;
+
+	ssize_t send_result = 1;
+	while (send_result > 0 && res->header_sent < res->header_length) {
+		if (content) {
+			// send as much of the body as fits along with the header, so small responses go out in one segment
+			struct iovec iov[2] = {
+				{ res->header_buf + res->header_sent, res->header_length - res->header_sent },
+				{ (char *) content + res->content_sent, res->content_length - res->content_sent }
+			};
+			send_result = htt_connection_sendmsg(conn, iov, 2, MSG_NOSIGNAL);
+			if (send_result > 0) {
+				size_t header_part = iov[0].iov_len < (size_t) send_result ? iov[0].iov_len : (size_t) send_result;
+				res->header_sent += header_part;
+				res->content_sent += send_result - header_part;
+			}
 		} else {
-			conn->callback = &http_response_header_callback;
-			conn->free_func = &destroy_response;
+			// tell the kernel the body is coming, so the header isn't pushed out on its own
+			int flags = MSG_NOSIGNAL | (res->content_fd != -1 || res->stream ? MSG_MORE : 0);
+			struct iovec iov = { res->header_buf + res->header_sent, res->header_length - res->header_sent };
+			send_result = htt_connection_sendmsg(conn, &iov, 1, flags);
+			if (send_result > 0) res->header_sent += send_result;
+		}
+	}
+
+	if (res->header_sent < res->header_length) {
+		if (send_result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			if (res->header_sent != prev_sent) htt_connection_set_timeout(conn, global_config.send_timeout);
+			return wait_writable(conn, &http_response_header_callback);
 		}
+		log_response(conn, res);
+		destroy_response(conn->data);
+		htt_connection_close(conn);
+		return -1;
 	}
+
+	// no content, this response is done
+	if (!http_response_has_content(res)) return finish_response(conn) ? 1 : -1;
 	
-	return 0;
+	// carry on with the body without waiting for another wakeup
+	return send_content(conn);
 }
 
 int http_response_header_callback(htt_connection_t *conn) {
-	struct http_response *res = conn->data;
+	int res = send_header(conn);
+	
+	// a pipelined request may have arrived while the response was being sent
+	if (res == 1 && ((struct sized_buffer *) conn->data)->len) return http_request_callback(conn);
+	return res < 0 ? -1 : 0;
+}
 
-	ssize_t send_result;
-    while ((send_result = send(conn->fd, res->header_buf + res->header_sent, res->header_length - res->header_sent, 0)) > 0) {
-        res->header_sent += send_result;
-    }
+// zero-copy path for files, falls back to splice if sendfile isn't supported
+static ssize_t send_file_content(htt_connection_t *conn, struct http_response *res) {
+	int fd = conn->fd;
+	size_t remaining = res->content_length - res->content_sent;
 
-	if (res->header_sent == res->header_length) {
-		if (res->content) conn->callback = &http_response_content_callback;
-		// no content, end connection
-		else {
-			destroy_response(conn->data);
-			htt_connection_close(conn);
+	if (res->splice_pipe[0] == -1) {
+		off_t offset = res->content_offset + res->content_sent;
+		ssize_t send_result = htt_connection_sendfile(conn, res->content_fd, offset, remaining);
+		if (send_result != -1 || (errno != EINVAL && errno != ENOSYS)) return send_result;
+		if (pipe2(res->splice_pipe, O_NONBLOCK | O_CLOEXEC) == -1) return -1;
+	}
+
+	// refill the pipe once everything in it has been sent
+	if (!res->splice_pipe_len) {
+		loff_t offset = res->content_offset + res->content_sent;
+		ssize_t fill_result = splice(res->content_fd, &offset, res->splice_pipe[1], NULL, remaining, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (fill_result <= 0) return fill_result;
+		res->splice_pipe_len = fill_result;
+	}
+
+	ssize_t send_result = splice(res->splice_pipe[0], NULL, fd, NULL, res->splice_pipe_len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (send_result > 0) res->splice_pipe_len -= send_result;
+	return send_result;
+}
+
+// Returns 1 once the whole body has been produced and sent, 0 if the socket is full, -1 on failure
+static int pump_stream(htt_connection_t *conn, struct http_response *res) {
+	struct http_body_stream *stream = res->stream;
+	for (;;) {
+		while (stream->pos < stream->end) {
+			struct iovec iov = { stream->buf + stream->pos, stream->end - stream->pos };
+			ssize_t send_result = htt_connection_sendmsg(conn, &iov, 1, MSG_NOSIGNAL);
+			if (send_result == -1) return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+			stream->pos += send_result;
+			res->content_sent += send_result;
 		}
+		if (stream->finished) return 1;
+		// the producer only runs once everything it made before is in the socket
+		if (http_stream_next(res)) return -1;
+	}
+}
+
+// Returns the same as send_header
+static int send_stream(htt_connection_t *conn) {
+	struct http_response *res = conn->data;
+	size_t prev_sent = res->content_sent;
+	
+	int pump_result = pump_stream(conn, res);
+	if (pump_result == -1) {
+		// the header has gone out already, so all the client can be told is that the body is cut short
+		log_response(conn, res);
+		destroy_response(conn->data);
+		htt_connection_close(conn);
+		return -1;
 	}
+	if (pump_result == 1) return finish_response(conn) ? 1 : -1;
 	
-	return 0;
+	if (res->content_sent != prev_sent) htt_connection_set_timeout(conn, global_config.send_timeout);
+	return wait_writable(conn, &http_response_content_callback);
 }
 
-int http_response_content_callback(htt_connection_t *conn) {
+// Returns the same as send_header
+static int send_content(htt_connection_t *conn) {
 	struct http_response *res = conn->data;
+	if (res->stream) return send_stream(conn);
+	size_t prev_sent = res->content_sent;
 
-	ssize_t send_result;
-	do {
-        fseek(res->content, res->content_sent, SEEK_SET);
-        char sendbuf[4096];
-        size_t buflen = fread(sendbuf, 1, sizeof(sendbuf), res->content);
-        send_result = send(conn->fd, sendbuf, buflen, 0);
-        if (send_result > 0) res->content_sent += send_result;
-    } while (send_result > 0);
-
-	if (res->content_sent == res->content_length) {
+	ssize_t send_result = 1;
+	while (send_result > 0 && res->content_sent < res->content_length) {
+		if (res->content_fd != -1) {
+			send_result = send_file_content(conn, res);
+		} else {
+			struct iovec iov = { (char *) memory_content(res) + res->content_sent, res->content_length - res->content_sent };
+			send_result = htt_connection_sendmsg(conn, &iov, 1, MSG_NOSIGNAL);
+		}
+		if (send_result > 0) res->content_sent += send_result;
+	}
+
+	// the file shrank underneath us or the client went away
+	if (res->content_sent < res->content_length && (send_result == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))) {
+		log_response(conn, res);
 		destroy_response(conn->data);
 		htt_connection_close(conn);
+		return -1;
 	}
+
+	if (res->content_sent == res->content_length) return finish_response(conn) ? 1 : -1;
 	
-	return 0;
+	// the client is still reading, so give it more time
+	if (res->content_sent != prev_sent) htt_connection_set_timeout(conn, global_config.send_timeout);
+	return wait_writable(conn, &http_response_content_callback);
+}
+
+int http_response_content_callback(htt_connection_t *conn) {
+	int res = send_content(conn);
+	
+	// a pipelined request may have arrived while the response was being sent
+	if (res == 1 && ((struct sized_buffer *) conn->data)->len) return http_request_callback(conn);
+	return res < 0 ? -1 : 0;
 }
@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 
@@ -12,6 +13,9 @@
 
 struct server_config global_config;
 
+// the only string option that doesn't default to NULL, and the one value of it that isn't freed
+static char DEFAULT_ACCESS_LOG_PATH[] = "-";
+
 int load_default_config(void) {
     if (!getcwd(global_config.root_path, sizeof(global_config.root_path))) {
     	return errno;
@@ -19,9 +23,27 @@ int load_default_config(void) {
 
     global_config.root_path_len = strlen(global_config.root_path);
     global_config.max_age = 60; // temporary value
-    global_config.mime_type_path = "mime-types.txt";
-    global_config.flags = CONFIG_DIR_LISTING | CONFIG_COURTESY_REDIR;
+    global_config.mime_type_path = NULL;
+    global_config.flags = CONFIG_DIR_LISTING | CONFIG_COURTESY_REDIR | CONFIG_COMPRESSION;
     global_config.server_port = htons(8000);
+    global_config.workers = 1;
+    global_config.listen_backlog = SOMAXCONN;
+    global_config.accept_batch = 64;
+    global_config.defer_accept = 0;
+    global_config.tcp_fastopen = 0;
+    global_config.cache_size = 16 << 20;
+    global_config.cache_max_file_size = 256 << 10;
+    global_config.dir_listing_page_size = 1000;
+    global_config.header_timeout = 30;
+    global_config.keepalive_timeout = 15;
+    global_config.send_timeout = 60;
+    global_config.event_backend = EVENT_BACKEND_EPOLL;
+    global_config.access_log_path = DEFAULT_ACCESS_LOG_PATH;
+    global_config.access_log_policy = LOG_POLICY_DROP;
+    global_config.access_log_ring_size = 8192;
+    global_config.path_cache_size = 4096;
+    global_config.path_cache_ttl = 2;
+    global_config.metrics_path = NULL; // counters and latencies aren't published unless asked for
     return 0;
 }
 
@@ -35,12 +57,32 @@ int load_config(const char *path) {
     assert(0 && "Not Implemented Yet");
 }
 
+// Replaces a string option with a value allocated by sscanf, freeing the one it had
+static void set_string_option(char **option, char *value) {
+	if (*option != DEFAULT_ACCESS_LOG_PATH) free(*option);
+	*option = value;
+}
+
+// Same, but "off" turns the option off
+static void set_optional_string_option(char **option, char *value) {
+	if (!strcmp(value, "off")) {
+		free(value);
+		value = NULL;
+	}
+	set_string_option(option, value);
+}
+
 int parse_config_option(const char *opt) {
+	char *str_opt;
+
 	if (sscanf(opt, "root_path=%4096s", global_config.root_path) == 1) {
 		global_config.root_path_len = strlen(global_config.root_path);
 		return 1;
 	}
-	if (sscanf(opt, "mime_type_path=%ms", &global_config.mime_type_path) == 1) return 1;
+	if (sscanf(opt, "mime_type_path=%ms", &str_opt) == 1) {
+		set_string_option(&global_config.mime_type_path, str_opt);
+		return 1;
+	}
 	if (sscanf(opt, "max_age=%d", &global_config.max_age) == 1) return 1;
 	
 	char bool_opt[6];
@@ -54,10 +96,65 @@ int parse_config_option(const char *opt) {
 		else global_config.flags &= ~CONFIG_COURTESY_REDIR;
 		return 1;
 	}
+	if (sscanf(opt, "cpu_affinity=%5s", bool_opt) == 1) {
+		if (!strcmp(bool_opt, "true")) global_config.flags |= CONFIG_CPU_AFFINITY;
+		else global_config.flags &= ~CONFIG_CPU_AFFINITY;
+		return 1;
+	}
+	if (sscanf(opt, "compression=%5s", bool_opt) == 1) {
+		if (!strcmp(bool_opt, "true")) global_config.flags |= CONFIG_COMPRESSION;
+		else global_config.flags &= ~CONFIG_COMPRESSION;
+		return 1;
+	}
+	if (sscanf(opt, "mmap_files=%5s", bool_opt) == 1) {
+		if (!strcmp(bool_opt, "true")) global_config.flags |= CONFIG_MMAP_FILES;
+		else global_config.flags &= ~CONFIG_MMAP_FILES;
+		return 1;
+	}
 	if (sscanf(opt, "server_port=%hu", &global_config.server_port) == 1) {
 		global_config.server_port = htons(global_config.server_port);
 		return 1;
 	}
+	if (sscanf(opt, "workers=%d", &global_config.workers) == 1) return 1;
+	if (sscanf(opt, "listen_backlog=%d", &global_config.listen_backlog) == 1) return 1;
+	if (sscanf(opt, "accept_batch=%u", &global_config.accept_batch) == 1) return 1;
+	if (sscanf(opt, "defer_accept=%u", &global_config.defer_accept) == 1) return 1;
+	if (sscanf(opt, "tcp_fastopen=%d", &global_config.tcp_fastopen) == 1) return 1;
+	if (sscanf(opt, "cache_size=%zu", &global_config.cache_size) == 1) return 1;
+	if (sscanf(opt, "cache_max_file_size=%zu", &global_config.cache_max_file_size) == 1) return 1;
+	if (sscanf(opt, "dir_listing_page_size=%zu", &global_config.dir_listing_page_size) == 1) return 1;
+	if (sscanf(opt, "header_timeout=%u", &global_config.header_timeout) == 1) return 1;
+	if (sscanf(opt, "keepalive_timeout=%u", &global_config.keepalive_timeout) == 1) return 1;
+	if (sscanf(opt, "send_timeout=%u", &global_config.send_timeout) == 1) return 1;
+	
+	char backend_opt[9];
+	if (sscanf(opt, "event_backend=%8s", backend_opt) == 1) {
+		if (!strcmp(backend_opt, "io_uring")) global_config.event_backend = EVENT_BACKEND_IO_URING;
+		else global_config.event_backend = EVENT_BACKEND_EPOLL;
+		return 1;
+	}
+	
+	if (sscanf(opt, "access_log=%ms", &str_opt) == 1) {
+		set_optional_string_option(&global_config.access_log_path, str_opt);
+		return 1;
+	}
+	if (sscanf(opt, "access_log_policy=%5s", bool_opt) == 1) {
+		if (!strcmp(bool_opt, "block")) global_config.access_log_policy = LOG_POLICY_BLOCK;
+		else global_config.access_log_policy = LOG_POLICY_DROP;
+		return 1;
+	}
+	if (sscanf(opt, "access_log_ring_size=%zu", &global_config.access_log_ring_size) == 1) return 1;
+	if (sscanf(opt, "path_cache_size=%zu", &global_config.path_cache_size) == 1) return 1;
+	if (sscanf(opt, "path_cache_ttl=%u", &global_config.path_cache_ttl) == 1) return 1;
+	
+	if (!strcmp(opt, "metrics_path=")) {
+		set_string_option(&global_config.metrics_path, NULL);
+		return 1;
+	}
+	if (sscanf(opt, "metrics_path=%ms", &str_opt) == 1) {
+		set_optional_string_option(&global_config.metrics_path, str_opt);
+		return 1;
+	}
 	
 	return 0;
 }
@@ -19,7 +19,15 @@
 #include "constants.h"
 
 enum server_config_flags {
-	CONFIG_DIR_LISTING = 1, CONFIG_COURTESY_REDIR = 2
+	CONFIG_DIR_LISTING = 1, CONFIG_COURTESY_REDIR = 2, CONFIG_CPU_AFFINITY = 4, CONFIG_COMPRESSION = 8, CONFIG_MMAP_FILES = 16
+};
+
+enum server_event_backend {
+	EVENT_BACKEND_EPOLL, EVENT_BACKEND_IO_URING
+};
+
+enum server_log_policy {
+	LOG_POLICY_DROP, LOG_POLICY_BLOCK
 };
 
 /**
@@ -28,10 +36,28 @@ enum server_config_flags {
 struct server_config {
     char root_path[HTTP_PATH_MAX];
     size_t root_path_len;
-    char *mime_type_path;
+    char *mime_type_path; ///< MIME type list to load instead of the built-in one, NULL to use the built-in one
     int max_age; ///< Max age of cached data
     int flags; ///< flag-based options
     in_port_t server_port;
+    int workers; ///< Number of event loops to run, 0 for one per online CPU
+    int listen_backlog; ///< Length of each listening socket's accept queue, capped by net.core.somaxconn
+    unsigned accept_batch; ///< Most connections an event loop accepts per wakeup before servicing the rest
+    unsigned defer_accept; ///< Seconds the kernel holds a connection until its request arrives, 0 to disable
+    int tcp_fastopen; ///< Length of the TCP Fast Open queue, 0 to disable
+    size_t cache_size; ///< Bytes of file data each event loop may keep in memory, 0 to disable
+    size_t cache_max_file_size; ///< Largest file that will be kept in memory
+    size_t dir_listing_page_size; ///< Entries on each page of a directory listing, 0 for a single page
+    unsigned header_timeout; ///< Seconds a client has to send a complete request header
+    unsigned keepalive_timeout; ///< Seconds an idle persistent connection is kept open
+    unsigned send_timeout; ///< Seconds a response may go without any progress
+    enum server_event_backend event_backend; ///< How event loops wait for connections, falls back to epoll
+    char *access_log_path; ///< File to append the access log to, "-" for stdout, NULL to disable
+    enum server_log_policy access_log_policy; ///< What an event loop does when its log buffer is full
+    size_t access_log_ring_size; ///< Number of log records each event loop can buffer
+    size_t path_cache_size; ///< Number of resolved request paths each event loop remembers, 0 to disable
+    unsigned path_cache_ttl; ///< Seconds a resolved request path is trusted for
+    char *metrics_path; ///< Request path the metrics are served at, NULL (the default) if they aren't served
 };
 
 extern struct server_config global_config;
@@ -1,4 +1,6 @@
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
@@ -6,68 +8,811 @@
 #include <fcntl.h>
 
 #include <sys/socket.h>
+#include <sys/sendfile.h>
 #include <sys/epoll.h>
 
+#include <netinet/in.h>
+
+#include "config.h"
+#include "access-log.h"
 #include "connection.h"
 #include "http.h"
 #include "callback.h"
+#include "metrics.h"
 
 #define MAX_EVENTS 128
+#define CONNECTION_SLAB_SIZE 64
+#define REQUEST_BUFFER_SIZE 8192
+#define URING_ENTRIES 256
+#define URING_FILES 4096
+#define URING_RECV_BUFFERS 512
+#define URING_RECV_BUFFER_SIZE 4096
+// beyond this much spilled input, the recv is stopped until the connection catches up
+#define RECV_SPILL_MAX (64 * 1024)
+// big enough that most files are spliced in one go, pipes silently stay smaller if it's not allowed
+#define SPLICE_PIPE_SIZE (1024 * 1024)
+
+// io_uring user data is a connection pointer with its generation in the top bits, which
+// user space pointers never use, and the operation in the low bits, which alignment leaves
+// clear. 0 is for completions nobody cares about.
+#define USER_DATA_PTR_BITS 48
+#define USER_DATA_OP_MASK 7
 
-static int epollfd;
-static int server_fd;
+enum uring_op {
+	OP_POLL,
+	OP_RECV,
+	OP_SEND,
+	OP_FILL, // splice from a file into the connection's pipe, linked to the OP_DRAIN after it
+	OP_DRAIN, // splice from the connection's pipe to its socket
+	OP_FILES_UPDATE
+};
+
+// take a connection from the pool, refilling it with a new slab if it is empty
+static htt_connection_t *alloc_connection(htt_server_t *server) {
+	if (!server->free_connections) {
+		htt_connection_t *slab = calloc(CONNECTION_SLAB_SIZE, sizeof(*slab));
+		if (!slab) return NULL;
+		for (int i = 0; i < CONNECTION_SLAB_SIZE; ++i) {
+			slab[i].io.file_index = -1;
+			slab[i].io.pipe[0] = slab[i].io.pipe[1] = -1;
+			slab[i].next_free = server->free_connections;
+			server->free_connections = &slab[i];
+		}
+	}
+	
+	htt_connection_t *conn = server->free_connections;
+	server->free_connections = conn->next_free;
+	conn->next_free = NULL;
+	conn->server = server;
+	// a slot stays with its connection for good, since connections are never freed
+	if (conn->io.file_index == -1 && server->fixed_files && server->next_file_index < URING_FILES) {
+		conn->io.file_index = server->next_file_index++;
+	}
+	return conn;
+}
 
 // default callbacks and data for new connections
 int htt_connection_init(htt_connection_t *conn) {
 	conn->callback = &http_request_callback;
-	conn->free_func = &free;
-	conn->data = calloc(1, sizeof(struct sized_buffer) + 8192);
-	if (conn->data) ((struct sized_buffer *) conn->data)->cap = 8192;
-	return !conn->data - 1;
+	conn->free_func = NULL;
+	
+	// the request buffer is the first thing in the arena, so it outlives every response
+	struct sized_buffer *header = htt_arena_alloc(&conn->arena, sizeof(*header) + REQUEST_BUFFER_SIZE);
+	if (!header) return -1;
+	header->cap = REQUEST_BUFFER_SIZE;
+	header->len = 0;
+	header->req_len = 0;
+	header->scanned = 0;
+	header->recv_start_ns = 0;
+	conn->data = header;
+	return 0;
 }
 
-void htt_connection_close(htt_connection_t *conn) {
+static uint64_t user_data(const htt_connection_t *conn, enum uring_op op) {
+	return (uintptr_t) conn | op | (uint64_t) conn->generation << USER_DATA_PTR_BITS;
+}
+
+static struct io_uring_sqe *get_sqe(htt_server_t *server) {
+	struct io_uring_sqe *sqe = htt_uring_get_sqe(&server->uring);
+	if (!sqe) htt_log_error("io_uring: submission queue is full");
+	return sqe;
+}
+
+// point a request at the connection's socket, through its registered slot if it has one
+static void set_socket(struct io_uring_sqe *sqe, const htt_connection_t *conn) {
+	if (conn->io.fixed_file) {
+		sqe->fd = conn->io.file_index;
+		sqe->flags |= IOSQE_FIXED_FILE;
+	} else {
+		sqe->fd = conn->fd;
+	}
+}
+
+// wait for the connection's events with a one-shot poll
+static int arm_poll(htt_connection_t *conn) {
+	struct io_uring_sqe *sqe = get_sqe(conn->server);
+	if (!sqe) return -1;
+	
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = conn->fd;
+	sqe->poll32_events = conn->events;
+	sqe->user_data = user_data(conn, OP_POLL);
+	conn->poll_armed = 1;
+	return 0;
+}
+
+// keep a recv going that fills buffers from the ring as data arrives
+static int arm_recv(htt_connection_t *conn) {
+	struct io_uring_sqe *sqe = get_sqe(conn->server);
+	if (!sqe) return -1;
+	
+	sqe->opcode = IORING_OP_RECV;
+	set_socket(sqe, conn);
+	sqe->flags |= IOSQE_BUFFER_SELECT;
+	sqe->buf_group = HTT_URING_BUFFER_GROUP;
+	if (conn->server->multishot_recv) sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->user_data = user_data(conn, OP_RECV);
+	conn->io.recv_state = HTT_RECV_ARMED;
+	return 0;
+}
+
+// put the socket in the connection's slot, linked to the request after it so that it runs first
+static int install_file(htt_connection_t *conn) {
+	struct io_uring_sqe *sqe = get_sqe(conn->server);
+	if (!sqe) return -1;
+	
+	// the connection isn't reused before this is submitted, so fd stays put
+	sqe->opcode = IORING_OP_FILES_UPDATE;
+	sqe->fd = -1;
+	sqe->addr = (uintptr_t) &conn->fd;
+	sqe->len = 1;
+	sqe->off = conn->io.file_index;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->user_data = user_data(conn, OP_FILES_UPDATE);
+	conn->io.fixed_file = 1;
+	return 0;
+}
+
+static void cancel(htt_connection_t *conn, enum uring_op op) {
+	struct io_uring_sqe *sqe = get_sqe(conn->server);
+	if (!sqe) return;
+	
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->addr = user_data(conn, op);
+}
+
+// close an fd in order with the submissions that still refer to it, so its number isn't reused first
+static void close_after_submit(htt_server_t *server, int fd) {
+	struct io_uring_sqe *sqe = get_sqe(server);
+	if (!sqe) {
+		close(fd);
+		return;
+	}
+	
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->fd = fd;
+}
+
+static int arm_accept(htt_server_t *server) {
+	struct io_uring_sqe *sqe = get_sqe(server);
+	if (!sqe) return -1;
+	
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = server->server_fd;
+	sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+	if (server->multishot_accept) sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->user_data = user_data(&server->listener, OP_POLL);
+	return 0;
+}
+
+int htt_connection_set_events(htt_connection_t *conn, uint32_t events) {
+	if (conn->events == events) return 0;
+	
+	// callbacks only run once their completion has arrived, so this is picked up when they return
+	if (conn->server->use_uring) {
+		conn->events = events;
+		return 0;
+	}
+	
+	struct epoll_event ev = {
+		.events = events,
+		.data.ptr = conn
+	};
+	
+	if (epoll_ctl(conn->server->epollfd, EPOLL_CTL_MOD, conn->fd, &ev) == -1) {
+		htt_log_error("epoll_ctl: client_fd: %s", strerror(errno));
+		return -1;
+	}
+	
+	conn->events = events;
+	return 0;
+}
+
+void htt_connection_set_timeout(htt_connection_t *conn, unsigned seconds) {
+	if (seconds) htt_timer_schedule(&conn->server->timers, &conn->timer, seconds);
+	else htt_timer_cancel(&conn->server->timers, &conn->timer);
+}
+
+// hand the oldest queued buffer back to the ring
+static void pop_recv_buffer(htt_connection_t *conn) {
+	struct htt_recv_queue *queue = &conn->io.queue;
+	htt_uring_recycle_buffer(&conn->server->uring, queue->bids[queue->head]);
+	queue->head = (queue->head + 1) % HTT_RECV_QUEUE_SIZE;
+	--queue->count;
+	queue->offset = 0;
+}
+
+// copy out queued input, returns the number of bytes copied
+static size_t read_queued(htt_connection_t *conn, char *buf, size_t len) {
+	struct htt_recv_queue *queue = &conn->io.queue;
+	size_t copied = 0;
+	while (copied < len && queue->count) {
+		size_t available = queue->lens[queue->head] - queue->offset;
+		size_t n = available < len - copied ? available : len - copied;
+		memcpy(buf + copied, htt_uring_buffer(&conn->server->uring, queue->bids[queue->head]) + queue->offset, n);
+		copied += n;
+		queue->offset += n;
+		if (queue->offset == queue->lens[queue->head]) pop_recv_buffer(conn);
+	}
+	
+	// the spill buffer only ever holds data that arrived after everything in the queue
+	if (copied < len && queue->spill_pos < queue->spill_len) {
+		size_t available = queue->spill_len - queue->spill_pos;
+		size_t n = available < len - copied ? available : len - copied;
+		memcpy(buf + copied, queue->spill + queue->spill_pos, n);
+		copied += n;
+		queue->spill_pos += n;
+		if (queue->spill_pos == queue->spill_len) queue->spill_len = queue->spill_pos = 0;
+	}
+	return copied;
+}
+
+ssize_t htt_connection_recv(htt_connection_t *conn, void *buf, size_t len) {
+	if (!conn->server->use_uring || !conn->server->recv_buffers) return recv(conn->fd, buf, len, 0);
+	
+	size_t copied = read_queued(conn, buf, len);
+	if (copied) {
+		++conn->io.recv_reads;
+		return copied;
+	}
+	
+	// nothing is armed while the ring is dry, so the socket can be read directly without reordering
+	if (conn->io.recv_poll) return recv(conn->fd, buf, len, 0);
+	if (conn->io.recv_error) {
+		++conn->io.recv_reads;
+		errno = conn->io.recv_error;
+		return -1;
+	}
+	if (conn->io.recv_eof) {
+		++conn->io.recv_reads;
+		return 0;
+	}
+	errno = EAGAIN;
+	return -1;
+}
+
+int htt_connection_has_input(const htt_connection_t *conn) {
+	const struct htt_recv_queue *queue = &conn->io.queue;
+	return conn->server->use_uring && (queue->count || queue->spill_pos < queue->spill_len);
+}
+
+// returns the result of a send once it has completed, or starts one if none is in flight.
+// Returns 1 if the result is in *result, 0 if the caller should start a send.
+static int take_send_result(htt_connection_t *conn, ssize_t *result) {
+	if (conn->io.send_state == HTT_SEND_IDLE) return 0;
+	
+	if (conn->io.send_state == HTT_SEND_PENDING) {
+		errno = EAGAIN;
+		*result = -1;
+	} else if (conn->io.send_result < 0) {
+		conn->io.send_state = HTT_SEND_IDLE;
+		errno = -conn->io.send_result;
+		*result = -1;
+	} else {
+		conn->io.send_state = HTT_SEND_IDLE;
+		*result = conn->io.send_result;
+	}
+	return 1;
+}
+
+ssize_t htt_connection_sendmsg(htt_connection_t *conn, const struct iovec *iov, int iovcnt, int flags) {
+	if (!conn->server->use_uring) {
+		struct msghdr msg = { .msg_iov = (struct iovec *) iov, .msg_iovlen = iovcnt };
+		return sendmsg(conn->fd, &msg, flags);
+	}
+	
+	ssize_t result;
+	if (take_send_result(conn, &result)) return result;
+	
+	struct io_uring_sqe *sqe = get_sqe(conn->server);
+	if (!sqe) return -1;
+	
+	// the kernel keeps going after a partial send, so the callback only runs again once it's all out
+	set_socket(sqe, conn);
+	sqe->msg_flags = flags | MSG_WAITALL;
+	sqe->user_data = user_data(conn, OP_SEND);
+	if (iovcnt == 1) {
+		sqe->opcode = IORING_OP_SEND;
+		sqe->addr = (uintptr_t) iov[0].iov_base;
+		sqe->len = iov[0].iov_len;
+	} else {
+		memcpy(conn->io.send_iov, iov, iovcnt * sizeof(*iov));
+		conn->io.send_msg = (struct msghdr) { .msg_iov = conn->io.send_iov, .msg_iovlen = iovcnt };
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->addr = (uintptr_t) &conn->io.send_msg;
+		sqe->len = 1;
+	}
+	conn->io.send_state = HTT_SEND_PENDING;
+	errno = EAGAIN;
+	return -1;
+}
+
+static int open_pipe(htt_connection_t *conn) {
+	if (pipe2(conn->io.pipe, O_CLOEXEC) == -1) return -1;
+	fcntl(conn->io.pipe[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+	int size = fcntl(conn->io.pipe[1], F_GETPIPE_SZ);
+	conn->io.pipe_size = size > 0 ? size : 65536;
+	conn->io.pipe_len = 0;
+	return 0;
+}
+
+// drain the pipe into the socket, after the fill linked before it if there is one
+static int queue_drain(htt_connection_t *conn, size_t len, int more) {
+	struct io_uring_sqe *sqe = get_sqe(conn->server);
+	if (!sqe) return -1;
+	
+	sqe->opcode = IORING_OP_SPLICE;
+	set_socket(sqe, conn);
+	sqe->off = -1;
+	sqe->splice_fd_in = conn->io.pipe[0];
+	sqe->splice_off_in = -1;
+	sqe->len = len;
+	sqe->splice_flags = SPLICE_F_MOVE | (more ? SPLICE_F_MORE : 0);
+	sqe->user_data = user_data(conn, OP_DRAIN);
+	conn->io.send_state = HTT_SEND_PENDING;
+	return 0;
+}
+
+ssize_t htt_connection_sendfile(htt_connection_t *conn, int in_fd, off_t offset, size_t count) {
+	if (!conn->server->use_uring) return sendfile(conn->fd, in_fd, &offset, count);
+	
+	ssize_t result;
+	if (take_send_result(conn, &result)) return result;
+	if (conn->io.pipe[0] == -1 && open_pipe(conn)) return -1;
+	
+	// whatever is left in the pipe is the start of what the caller wants next
+	if (conn->io.pipe_len) {
+		if (queue_drain(conn, conn->io.pipe_len, count > conn->io.pipe_len)) return -1;
+		errno = EAGAIN;
+		return -1;
+	}
+	
+	// fill the pipe and drain it in one go. A short fill breaks the link, and what
+	// did go into the pipe is drained once the fill completes.
+	size_t len = count < conn->io.pipe_size ? count : conn->io.pipe_size;
+	struct io_uring_sqe *sqe = get_sqe(conn->server);
+	if (!sqe) return -1;
+	sqe->opcode = IORING_OP_SPLICE;
+	sqe->fd = conn->io.pipe[1];
+	sqe->off = -1;
+	sqe->splice_fd_in = in_fd;
+	sqe->splice_off_in = offset;
+	sqe->len = len;
+	sqe->splice_flags = SPLICE_F_MOVE;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->user_data = user_data(conn, OP_FILL);
+	conn->io.fill_result = 0;
+	if (queue_drain(conn, len, count > len)) return -1;
+	errno = EAGAIN;
+	return -1;
+}
+
+// tear down the io_uring side of a connection. The socket is shut down right away, so sends in
+// flight stop before the memory they point at is reused, but fds are closed in order with the
+// submissions that still refer to them.
+static void uring_close(htt_connection_t *conn) {
+	static const int no_file = -1;
+	struct htt_uring_io *io = &conn->io;
+	
+	// the poll keeps its own reference to the socket, so closing it isn't enough
+	if (conn->poll_armed) {
+		struct io_uring_sqe *sqe = get_sqe(conn->server);
+		if (sqe) {
+			sqe->opcode = IORING_OP_POLL_REMOVE;
+			sqe->addr = user_data(conn, OP_POLL);
+		}
+		conn->poll_armed = 0;
+	}
+	if (io->recv_state != HTT_RECV_IDLE) cancel(conn, OP_RECV);
+	
+	while (io->queue.count) pop_recv_buffer(conn);
+	free(io->queue.spill);
+	io->queue.spill = NULL;
+	io->queue.spill_len = io->queue.spill_cap = io->queue.spill_pos = 0;
+	
+	// a splice may still be filling the pipe, so only an empty, idle one is kept
+	if (io->pipe[0] != -1 && (io->pipe_len || io->send_state == HTT_SEND_PENDING)) {
+		close_after_submit(conn->server, io->pipe[0]);
+		close_after_submit(conn->server, io->pipe[1]);
+		io->pipe[0] = io->pipe[1] = -1;
+	}
+	
+	if (io->fixed_file) {
+		struct io_uring_sqe *sqe = get_sqe(conn->server);
+		if (sqe) {
+			sqe->opcode = IORING_OP_FILES_UPDATE;
+			sqe->fd = -1;
+			sqe->addr = (uintptr_t) &no_file;
+			sqe->len = 1;
+			sqe->off = io->file_index;
+		}
+		io->fixed_file = 0;
+	}
+	
+	io->recv_state = HTT_RECV_IDLE;
+	io->recv_poll = io->recv_eof = io->recv_error = 0;
+	io->send_state = HTT_SEND_IDLE;
+	++conn->generation;
 	shutdown(conn->fd, SHUT_RDWR);
-	close(conn->fd);
-	epoll_ctl(epollfd, EPOLL_CTL_DEL, conn->fd, NULL);
-	free(conn);
+	close_after_submit(conn->server, conn->fd);
 }
 
-void htt_server_init(int fd) {
-	server_fd = fd;
-	epollfd = epoll_create1(0);
-	if (epollfd == -1) {
-		fprintf(stderr, "epoll_create1: %s\n", strerror(errno));
-		exit(1);
+void htt_connection_close(htt_connection_t *conn) {
+	htt_server_t *server = conn->server;
+	htt_metrics_add(HTT_METRIC_CLOSES, 1);
+	htt_timer_cancel(&server->timers, &conn->timer);
+	if (server->use_uring) {
+		uring_close(conn);
+	} else {
+		epoll_ctl(server->epollfd, EPOLL_CTL_DEL, conn->fd, NULL);
+		shutdown(conn->fd, SHUT_RDWR);
+		close(conn->fd);
+	}
+	htt_arena_reset(&conn->arena);
+	conn->data = NULL;
+	
+	// queued submissions may still point into the connection, so it waits for the next submit
+	if (server->use_uring) {
+		conn->next_free = server->closed_connections;
+		server->closed_connections = conn;
+	} else {
+		conn->next_free = server->free_connections;
+		server->free_connections = conn;
+	}
+}
+
+// Returns 0 on success, -1 if the event loop can't continue
+static int accept_connection(htt_server_t *server, int client_fd, const struct sockaddr_in *peer) {
+	htt_connection_t *conn = alloc_connection(server);
+	if (!conn) {
+		close(client_fd);
+		return 0;
+	}
+	conn->fd = client_fd;
+	htt_metrics_add(HTT_METRIC_ACCEPTS, 1);
+	
+	// multishot accepts can't hand back addresses, so only ask for it when it will be logged
+	struct sockaddr_in addr = {0};
+	if (!peer && global_config.access_log_path) {
+		socklen_t addr_len = sizeof(addr);
+		getpeername(client_fd, (struct sockaddr *) &addr, &addr_len);
+		peer = &addr;
+	}
+	conn->peer_addr = peer ? peer->sin_addr.s_addr : 0;
+	conn->events = EPOLLIN | EPOLLRDHUP;
+	conn->read_closed = 0;
+	if (htt_connection_init(conn)) {
+		htt_connection_close(conn);
+		return 0;
 	}
+	htt_connection_set_timeout(conn, global_config.header_timeout);
 	
-	// allocate data for server fd
-	htt_connection_t *server_conn = malloc(sizeof(*server_conn));
-	if (!server_conn) {
-		fprintf(stderr, "Unable to allocate memory for server connection.\n");
-		exit(1);
+	if (server->use_uring) {
+		if (!server->recv_buffers) return arm_poll(conn);
+		if (conn->io.file_index != -1 && install_file(conn)) return -1;
+		return arm_recv(conn);
 	}
 	
-	server_conn->fd = server_fd;
+	struct epoll_event ev = {
+		.events = conn->events,
+		.data.ptr = conn
+	};
+	
+	if (epoll_ctl(server->epollfd, EPOLL_CTL_ADD, client_fd, &ev) == -1) {
+		fprintf(stderr, "epoll_ctl: client_fd: %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static int uring_server_init(htt_server_t *server) {
+	if (htt_uring_init(&server->uring, URING_ENTRIES)) {
+		htt_log_error("io_uring is unavailable, using epoll instead: %s", strerror(errno));
+		return -1;
+	}
+	
+	server->use_uring = 1;
+	server->multishot_accept = 1;
+	server->multishot_recv = 1;
+	server->next_file_index = 0;
+	server->fixed_files = !htt_uring_register_files(&server->uring, URING_FILES);
+	server->recv_buffers = !htt_uring_setup_buffers(&server->uring, URING_RECV_BUFFERS, URING_RECV_BUFFER_SIZE);
+	if (!server->recv_buffers) {
+		htt_log_error("io_uring: provided buffers are unavailable, polling before each recv instead: %s", strerror(errno));
+	}
+	if (arm_accept(server)) {
+		htt_uring_destroy(&server->uring);
+		server->use_uring = 0;
+		return -1;
+	}
+	return 0;
+}
+
+int htt_server_init(htt_server_t *server, int server_fd) {
+	server->server_fd = server_fd;
+	server->listener.server = server;
+	server->listener.fd = server_fd;
+	server->listener.generation = 0;
+	server->free_connections = NULL;
+	server->closed_connections = NULL;
+	server->use_uring = 0;
+	server->epollfd = -1;
+	htt_timer_wheel_init(&server->timers);
+	
+	if (global_config.event_backend == EVENT_BACKEND_IO_URING && !uring_server_init(server)) return 0;
+	
+	server->epollfd = epoll_create1(EPOLL_CLOEXEC);
+	if (server->epollfd == -1) {
+		fprintf(stderr, "epoll_create1: %s\n", strerror(errno));
+		return -1;
+	}
 	
 	// add listening socket to epoll
 	struct epoll_event listen_ev = {
 		.events = EPOLLIN,
-		.data.ptr = server_conn
+		.data.ptr = &server->listener
 	};
 	
-	if (epoll_ctl(epollfd, EPOLL_CTL_ADD, server_fd, &listen_ev) == -1) {
+	if (epoll_ctl(server->epollfd, EPOLL_CTL_ADD, server_fd, &listen_ev) == -1) {
 		fprintf(stderr, "epoll_ctl: server_fd: %s\n", strerror(errno));
-		exit(1);
+		close(server->epollfd);
+		return -1;
 	}
+	
+	return 0;
+}
+
+static void expire_connection(struct htt_timer *timer) {
+	htt_connection_t *conn = (htt_connection_t *) ((char *) timer - offsetof(htt_connection_t, timer));
+	if (conn->free_func) conn->free_func(conn->data);
+	htt_connection_close(conn);
+}
+
+static int handle_accept_completion(htt_server_t *server, int res, unsigned flags) {
+	if (res >= 0) {
+		if (accept_connection(server, res, NULL)) return -1;
+	} else if (res == -EINVAL && server->multishot_accept) {
+		// older kernels only accept one connection at a time
+		server->multishot_accept = 0;
+	} else {
+		htt_log_error("accept: %s", strerror(-res));
+	}
+	
+	// a multishot accept keeps going until it fails or is cancelled
+	if (!(flags & IORING_CQE_F_MORE)) return arm_accept(server);
+	return 0;
+}
+
+// queue data a recv delivered, copying it to the spill buffer if the queue is full
+static void queue_input(htt_connection_t *conn, unsigned short bid, size_t len) {
+	struct htt_recv_queue *queue = &conn->io.queue;
+	if (queue->count < HTT_RECV_QUEUE_SIZE && !queue->spill_len) {
+		unsigned tail = (queue->head + queue->count++) % HTT_RECV_QUEUE_SIZE;
+		queue->bids[tail] = bid;
+		queue->lens[tail] = len;
+		return;
+	}
+	
+	if (queue->spill_pos) {
+		memmove(queue->spill, queue->spill + queue->spill_pos, queue->spill_len - queue->spill_pos);
+		queue->spill_len -= queue->spill_pos;
+		queue->spill_pos = 0;
+	}
+	if (queue->spill_len + len > queue->spill_cap) {
+		size_t cap = queue->spill_cap ? queue->spill_cap * 2 : URING_RECV_BUFFER_SIZE * 4;
+		while (cap < queue->spill_len + len) cap *= 2;
+		char *spill = realloc(queue->spill, cap);
+		if (!spill) {
+			conn->io.recv_error = ENOMEM;
+			htt_uring_recycle_buffer(&conn->server->uring, bid);
+			return;
+		}
+		queue->spill = spill;
+		queue->spill_cap = cap;
+	}
+	memcpy(queue->spill + queue->spill_len, htt_uring_buffer(&conn->server->uring, bid), len);
+	queue->spill_len += len;
+	htt_uring_recycle_buffer(&conn->server->uring, bid);
+}
+
+static void complete_recv(htt_connection_t *conn, int res, unsigned flags) {
+	struct htt_uring_io *io = &conn->io;
+	// a multishot recv keeps going until it fails or is cancelled
+	if (!(flags & IORING_CQE_F_MORE)) io->recv_state = HTT_RECV_IDLE;
+	
+	if (res > 0) {
+		queue_input(conn, flags >> IORING_CQE_BUFFER_SHIFT, res);
+	} else if (res == 0) {
+		io->recv_eof = 1;
+		conn->read_closed = 1;
+	} else if (res == -ENOBUFS) {
+		// every buffer is queued somewhere, so fall back to polling until this connection catches up
+		io->recv_poll = 1;
+	} else if (res == -EINVAL && conn->server->multishot_recv) {
+		// older kernels only fill one buffer per recv
+		conn->server->multishot_recv = 0;
+	} else if (res != -ECANCELED) {
+		// cancelled recvs are either catching up or were linked to a failed install, and are re-armed
+		io->recv_error = -res;
+	}
+}
+
+// Returns 1 if the send is done, 0 if it is still going
+static int complete_drain(htt_connection_t *conn, int res) {
+	struct htt_uring_io *io = &conn->io;
+	if (res > 0) io->pipe_len -= res;
+	if (res != -ECANCELED) {
+		io->send_result = res;
+		return 1;
+	}
+	
+	// a short fill breaks the link, so send what did make it into the pipe
+	if (io->pipe_len) {
+		if (!queue_drain(conn, io->pipe_len, 0)) return 0;
+		io->send_result = -EBUSY;
+		return 1;
+	}
+	io->send_result = io->fill_result;
+	return 1;
+}
+
+// the connection's recv has data the callback hasn't read, or news of why there will be no more
+static int input_waiting(const htt_connection_t *conn) {
+	return htt_connection_has_input(conn) || conn->io.recv_eof || conn->io.recv_error;
+}
+
+// re-arm whatever the connection is waiting for once its callback has caught up.
+// Returns 0 on success, -1 on failure
+static int rearm(htt_connection_t *conn) {
+	struct htt_uring_io *io = &conn->io;
+	if (conn->server->recv_buffers && !io->recv_poll && !io->recv_eof && !io->recv_error) {
+		if (io->queue.spill_len <= RECV_SPILL_MAX) {
+			if (io->recv_state == HTT_RECV_IDLE && arm_recv(conn)) return -1;
+		} else if (io->recv_state == HTT_RECV_ARMED) {
+			cancel(conn, OP_RECV);
+			io->recv_state = HTT_RECV_CANCELLING;
+		}
+	}
+	
+	// polls only cover what completions don't: reading without buffers, and writing after a
+	// send that went around io_uring and would have blocked
+	int need_poll = conn->events & EPOLLIN ? !conn->server->recv_buffers || io->recv_poll : io->send_state == HTT_SEND_IDLE;
+	if (need_poll && !conn->poll_armed) return arm_poll(conn);
+	return 0;
+}
+
+static void handle_completion(htt_connection_t *conn, enum uring_op op, int res, unsigned flags) {
+	struct htt_uring_io *io = &conn->io;
+	uint16_t generation = conn->generation;
+	int run_callback = 0;
+	int polled_recv = 0;
+	
+	switch (op) {
+	case OP_POLL:
+		conn->poll_armed = 0;
+		if (res < 0 || res & (EPOLLERR | EPOLLHUP)) {
+			if (conn->free_func) conn->free_func(conn->data);
+			htt_connection_close(conn);
+			return;
+		}
+		if (res & EPOLLRDHUP) conn->read_closed = 1;
+		polled_recv = io->recv_poll;
+		run_callback = 1;
+		break;
+	case OP_RECV:
+		complete_recv(conn, res, flags);
+		break;
+	case OP_SEND:
+		io->send_result = res;
+		run_callback = 1;
+		break;
+	case OP_FILL:
+		io->fill_result = res;
+		if (res > 0) io->pipe_len += res;
+		break;
+	case OP_DRAIN:
+		run_callback = complete_drain(conn, res);
+		break;
+	case OP_FILES_UPDATE:
+		// the linked recv is cancelled and re-armed on the plain fd
+		if (res < 0) io->fixed_file = 0;
+		break;
+	}
+	
+	if (run_callback && op != OP_POLL) io->send_state = HTT_SEND_DONE;
+	if (run_callback) conn->callback(conn);
+	if (conn->generation != generation) return;
+	// the poll said the socket is readable and the callback has read it, so try the buffers again
+	if (polled_recv) io->recv_poll = 0;
+	
+	// input is only read while waiting for a request, and no completion will come for what's queued already
+	while (conn->events & EPOLLIN && io->send_state == HTT_SEND_IDLE && input_waiting(conn)) {
+		uint64_t reads = io->recv_reads;
+		conn->callback(conn);
+		if (conn->generation != generation) return;
+		if (io->recv_reads == reads) break;
+	}
+	
+	if (rearm(conn)) {
+		if (conn->free_func) conn->free_func(conn->data);
+		htt_connection_close(conn);
+	}
+}
+
+static int uring_server_poll(htt_server_t *server) {
+	if (htt_uring_submit_and_wait(&server->uring, htt_timer_wheel_timeout(&server->timers))) {
+		fprintf(stderr, "io_uring_enter: %s\n", strerror(errno));
+		return -1;
+	}
+	
+	// nothing queued refers to connections closed before the submit anymore
+	while (server->closed_connections) {
+		htt_connection_t *conn = server->closed_connections;
+		server->closed_connections = conn->next_free;
+		conn->next_free = server->free_connections;
+		server->free_connections = conn;
+	}
+	
+	struct io_uring_cqe *cqe;
+	while ((cqe = htt_uring_peek_cqe(&server->uring))) {
+		uint64_t data = cqe->user_data;
+		int res = cqe->res;
+		unsigned flags = cqe->flags;
+		htt_uring_cqe_seen(&server->uring);
+		if (!data) continue;
+		
+		htt_connection_t *conn = (htt_connection_t *) (uintptr_t) (data & ((1ULL << USER_DATA_PTR_BITS) - 1) & ~(uint64_t) USER_DATA_OP_MASK);
+		enum uring_op op = data & USER_DATA_OP_MASK;
+		uint16_t generation = data >> USER_DATA_PTR_BITS;
+		
+		if (conn == &server->listener) {
+			if (handle_accept_completion(server, res, flags)) return -1;
+			continue;
+		}
+		
+		// connections are never freed, only pooled, so this is safe even if it was closed.
+		// A buffer filled for a closed connection still has to go back to the ring.
+		if (conn->generation != generation) {
+			if (flags & IORING_CQE_F_BUFFER) htt_uring_recycle_buffer(&server->uring, flags >> IORING_CQE_BUFFER_SHIFT);
+			continue;
+		}
+		handle_completion(conn, op, res, flags);
+	}
+	
+	htt_timer_wheel_advance(&server->timers, &expire_connection);
+	return 0;
+}
+
+// Accepts up to accept_batch connections. The listener is level triggered, so any that are
+// left over wake the loop again, but only after the connections that are ready now are serviced.
+// Returns 0 on success, -1 if the event loop can't continue
+static int accept_pending(htt_server_t *server) {
+	unsigned accepted = 0;
+	do {
+		struct sockaddr_in peer;
+		socklen_t peer_len = sizeof(peer);
+		int client_fd = accept4(server->server_fd, (struct sockaddr *) &peer, &peer_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (client_fd == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+			// the client gave up while it was queued
+			if (errno == ECONNABORTED || errno == EINTR) continue;
+			htt_log_error("accept4: %s", strerror(errno));
+			return 0;
+		}
+		if (accept_connection(server, client_fd, &peer)) return -1;
+	} while (++accepted < global_config.accept_batch);
+	return 0;
 }
 
 // Return -1 on error, 0 on success
-int htt_server_poll(void) {
+int htt_server_poll(htt_server_t *server) {
+	if (server->use_uring) return uring_server_poll(server);
+	
 	struct epoll_event events[MAX_EVENTS];
 	
-	int nfds = epoll_wait(epollfd, events, MAX_EVENTS, -1);
+	int nfds = epoll_wait(server->epollfd, events, MAX_EVENTS, htt_timer_wheel_timeout(&server->timers));
 	if (nfds == -1) {
+		if (errno == EINTR) return 0;
 		fprintf(stderr, "epoll_wait: %s\n", strerror(errno));
 		return -1;
 	}
@@ -75,33 +820,22 @@ int htt_server_poll(void) {
 	for (int i = 0; i < nfds; ++i) {
 		htt_connection_t *cdata = events[i].data.ptr;
 		
-		if (cdata->fd == server_fd) {
-			int client_fd = accept(server_fd, NULL, NULL);
-			if (client_fd != -1) {
-				// set nonblocking
-				int flags = fcntl(client_fd, F_GETFL, 0);
-				fcntl(client_fd, F_SETFL, flags | O_NONBLOCK);
-				htt_connection_t *conn = malloc(sizeof(*conn));
-				conn->fd = client_fd;
-				struct epoll_event ev = {
-					.events = EPOLLIN | EPOLLOUT,
-					.data.ptr = conn
-				};
-				
-				if (epoll_ctl(epollfd, EPOLL_CTL_ADD, client_fd, &ev) == -1) {
-					fprintf(stderr, "epoll_ctl: client_fd: %s\n", strerror(errno));
-					return -1;
-				}
-				
-				htt_connection_init(conn);
-			}
-		} else if (events[i].events & EPOLLERR) {
-			cdata->free_func(cdata->data);
+		if (cdata == &server->listener) {
+			if (accept_pending(server)) return -1;
+		} else if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+			// nothing more can be sent in either direction
+			if (cdata->free_func) cdata->free_func(cdata->data);
 			htt_connection_close(cdata);
 		} else {
+			// the callback still reads whatever the client sent before shutting down
+			if (events[i].events & EPOLLRDHUP) cdata->read_closed = 1;
 			cdata->callback(cdata);
 		}
 	}
+	
+	// expire connections only after the events are handled, since closing one would leave
+	// a dangling pointer in events that the pool could hand out again
+	htt_timer_wheel_advance(&server->timers, &expire_connection);
 
 	return 0;
 }
@@ -11,7 +11,18 @@
 #ifndef CONNECTION_H
 #define CONNECTION_H
 
+#include <stdint.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "arena.h"
+#include "timer-wheel.h"
+#include "uring.h"
+
 typedef struct htt_connection htt_connection_t;
+typedef struct htt_server htt_server_t;
 
 /**
  * @brief function pointer type for callbacks
@@ -23,16 +34,118 @@ typedef int (*htt_callback_t)(htt_connection_t *connection);
  */
 typedef void (*htt_free_t)(void *data);
 
+/**
+ * @brief Number of filled recv buffers a connection can hold before it spills
+ */
+#define HTT_RECV_QUEUE_SIZE 16
+
+/**
+ * @brief Data an io_uring recv has delivered that the connection hasn't read yet
+ * @details The multishot recv keeps filling buffers from the server's buffer ring while the
+ * connection is busy sending, so filled buffers wait here until htt_connection_recv copies them
+ * out and hands them back. Once the queue is full, data is copied to the spill buffer instead,
+ * which is only read after the queue, so nothing is reordered.
+ */
+struct htt_recv_queue {
+    uint16_t bids[HTT_RECV_QUEUE_SIZE]; ///< ids of the filled buffers, oldest at head
+    uint32_t lens[HTT_RECV_QUEUE_SIZE]; ///< number of bytes in each buffer
+    unsigned head;
+    unsigned count;
+    uint32_t offset; ///< bytes of the oldest buffer that have been read already
+    char *spill; ///< data that arrived while the queue was full, NULL if none has
+    size_t spill_len;
+    size_t spill_cap;
+    size_t spill_pos; ///< bytes of the spill buffer that have been read already
+};
+
+/**
+ * @brief State of the recv a connection keeps armed under io_uring
+ */
+enum htt_recv_state {
+    HTT_RECV_IDLE, ///< nothing is armed
+    HTT_RECV_ARMED,
+    HTT_RECV_CANCELLING ///< too much is queued, so the recv is being stopped until it's read
+};
+
+/**
+ * @brief State of the send a connection has in flight under io_uring
+ */
+enum htt_send_state {
+    HTT_SEND_IDLE,
+    HTT_SEND_PENDING,
+    HTT_SEND_DONE ///< the result is waiting for the call that started the send
+};
+
+/**
+ * @brief Per connection state of the io_uring data path
+ */
+struct htt_uring_io {
+    int file_index; ///< slot in the registered file table, -1 if the connection has none
+    int fixed_file; ///< the socket is installed in its slot
+    enum htt_recv_state recv_state;
+    int recv_poll; ///< the buffer ring ran dry, so wait with a poll and recv directly for now
+    int recv_eof; ///< the client has shut down its side and everything before that was queued
+    int recv_error; ///< errno that ended the recv, 0 if it didn't fail
+    uint64_t recv_reads; ///< reads that returned something, to tell whether a callback made progress
+    struct htt_recv_queue queue;
+    enum htt_send_state send_state;
+    ssize_t send_result; ///< bytes sent or a negative errno, once the send is done
+    struct iovec send_iov[2]; ///< the data being sent, which has to outlive the call that sent it
+    struct msghdr send_msg;
+    int pipe[2]; ///< carries files from the page cache to the socket, -1 until a file is sent
+    size_t pipe_size;
+    size_t pipe_len; ///< bytes in the pipe that haven't been sent yet
+    ssize_t fill_result; ///< result of the latest splice into the pipe
+};
+
 /**
  * @brief The data for a connection
  */
 struct htt_connection {
     htt_callback_t callback;
-    htt_free_t free_func; // used if an error occurred
+    htt_free_t free_func; // used if an error occurred, may be NULL if data is owned by the arena
     void *data;
+    htt_server_t *server; ///< event loop the connection belongs to
+    struct htt_arena arena; ///< memory for the request buffer and the response being sent
+    htt_connection_t *next_free; ///< next connection in the server's pool
+    struct htt_timer timer; ///< closes the connection if it stalls
+    uint32_t events; ///< epoll events the connection is waiting for
+    int read_closed; ///< the client has shut down its side, so it won't send another request
+    uint16_t generation; ///< changed every time the connection is closed, to recognize stale io_uring completions
+    int poll_armed; ///< an io_uring poll is waiting on the connection
+    struct htt_uring_io io; ///< only used with io_uring
+    uint32_t peer_addr; ///< IPv4 address of the client in network byte order, 0 if unknown
     int fd;
 };
 
+/**
+ * @brief The state of a single event loop
+ * @details Each worker owns one of these along with its own listening socket.
+ * It waits on either epoll or io_uring, depending on the event_backend option.
+ * With io_uring, the data path is completion based rather than readiness based.
+ * Accepts and recvs are multishot, with recvs filling buffers from a provided
+ * buffer ring, and responses go out as sends, or as splices through a pipe for
+ * files. Sockets are installed in a registered file table. Every submission is
+ * batched into the same system call that waits for completions, so a request
+ * that fits in one recv costs a single system call on its way in and out.
+ * A one-shot poll is only used when a buffer ring or an operation isn't available.
+ */
+struct htt_server {
+    int epollfd; ///< -1 when using io_uring
+    struct htt_uring uring; ///< only set up when using io_uring
+    int use_uring;
+    int multishot_accept; ///< cleared if the kernel doesn't support multishot accept
+    int recv_buffers; ///< the ring has provided buffers, so connections recv instead of polling
+    int multishot_recv; ///< cleared if the kernel doesn't support multishot recv
+    int fixed_files; ///< the ring has a registered file table for sockets
+    int next_file_index; ///< next slot in the file table to hand to a connection
+    int server_fd;
+    htt_connection_t listener; ///< connection data for the listening socket
+    htt_connection_t *free_connections; ///< pool of closed connections to reuse
+    htt_connection_t *closed_connections; ///< closed since the last submit, which may still refer to them
+    struct htt_timer_wheel timers; ///< deadlines for every connection on this event loop
+};
+
 /**
  * @brief assign default callbacks and data for new connections
  *
@@ -41,23 +154,100 @@ struct htt_connection {
  */
 int htt_connection_init(htt_connection_t *conn);
 
+/**
+ * @brief change the events a connection is waiting for
+ * @details Connections wait for EPOLLIN | EPOLLRDHUP while receiving a request. Responses are
+ * sent right away, and a connection only waits for EPOLLOUT once a send would block, so an idle
+ * connection is never woken up just because it is writable.
+ * With io_uring, the change takes effect when the connection's callback returns.
+ *
+ * @param conn connection to modify
+ * @param events epoll events to wait for
+ * @return 0 on success, -1 on failure
+ */
+int htt_connection_set_events(htt_connection_t *conn, uint32_t events);
+
+/**
+ * @brief receive data from a connection, like recv
+ * @details With io_uring, this copies out what the connection's recv has already delivered,
+ * and fails with EAGAIN if nothing has arrived yet. The callback runs again once it has.
+ *
+ * @param conn connection to receive from
+ * @param buf where to put the data
+ * @param len size of buf
+ * @return number of bytes received, 0 if the client shut down its side, -1 on failure with errno set
+ */
+ssize_t htt_connection_recv(htt_connection_t *conn, void *buf, size_t len);
+
+/**
+ * @brief check for received data that htt_connection_recv hasn't returned yet
+ *
+ * @param conn connection to check
+ * @return 1 if there is some, 0 otherwise
+ */
+int htt_connection_has_input(const htt_connection_t *conn);
+
+/**
+ * @brief send data to a connection, like sendmsg
+ * @details With io_uring, the first call starts the send and fails with EAGAIN. Once the send
+ * completes, the callback runs again and must repeat the call, which then returns the result.
+ * Nothing else may be sent in between. The data has to stay put until the result is returned.
+ *
+ * @param conn connection to send to
+ * @param iov data to send, at most 2 parts
+ * @param iovcnt number of parts
+ * @param flags flags for sendmsg, such as MSG_MORE
+ * @return number of bytes sent, -1 on failure with errno set
+ */
+ssize_t htt_connection_sendmsg(htt_connection_t *conn, const struct iovec *iov, int iovcnt, int flags);
+
+/**
+ * @brief send part of a file to a connection, like sendfile
+ * @details With io_uring, the file is spliced through a pipe owned by the connection, following
+ * the same protocol as htt_connection_sendmsg. Bytes that went into the pipe but not out of it
+ * are sent first by the next call, which has to continue right after what was sent.
+ *
+ * @param conn connection to send to
+ * @param in_fd file to send from
+ * @param offset where to start in the file
+ * @param count number of bytes to send
+ * @return number of bytes sent, 0 if the file ended early, -1 on failure with errno set
+ */
+ssize_t htt_connection_sendfile(htt_connection_t *conn, int in_fd, off_t offset, size_t count);
+
+/**
+ * @brief set how long a connection may wait for its next event before it is closed
+ * @details The deadline replaces any previous one. When it passes, the connection's data is
+ * freed with free_func and the connection is closed.
+ *
+ * @param conn connection to set the deadline for
+ * @param seconds number of seconds from now, or 0 to remove the deadline
+ */
+void htt_connection_set_timeout(htt_connection_t *conn, unsigned seconds);
+
 /**
  * @brief close a connection
+ * @details The connection is returned to its server's pool, along with its arena.
  *
  * @param conn connection to close
  */
 void htt_connection_close(htt_connection_t *conn);
 
 /**
- * @brief initialize web server
+ * @brief initialize an event loop for a listening socket
+ *
+ * @param server event loop to initialize
+ * @param server_fd listening socket to accept connections from
+ * @return 0 on success, -1 on failure
  */
-void htt_server_init(int server_fd);
+int htt_server_init(htt_server_t *server, int server_fd);
 
 /**
  * @brief poll connections
  *
+ * @param server event loop to poll
  * @return 0, unless the server encountered an error.
  */
-int htt_server_poll(void);
+int htt_server_poll(htt_server_t *server);
 
 #endif // CONNECTION_H
@@ -12,5 +12,6 @@
 #define HTTP_CONSTANTS_H
 
 #define HTTP_PATH_MAX 4096
+#define HTTP_HEADER_MAX 8192
 
 #endif
\ No newline at end of file
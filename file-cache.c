@@ -0,0 +1,221 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "file-cache.h"
+
+#define INITIAL_BUCKETS 256
+
+// one cache per event loop, so nothing here needs locking
+struct file_cache {
+	struct file_cache_entry **buckets;
+	size_t bucket_count;
+	size_t entry_count;
+	size_t total_size; ///< bytes of file data held by the cache
+	struct file_cache_entry *lru_head; ///< most recently used
+	struct file_cache_entry *lru_tail; ///< least recently used
+};
+
+static _Thread_local struct file_cache cache;
+
+// FNV-1a
+static size_t hash_path(const char *path) {
+	size_t h = 14695981039346656037ULL;
+	for (; *path; ++path) {
+		h ^= (unsigned char) *path;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+static int same_file(const struct stat *a, const struct stat *b) {
+	return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+		a->st_size == b->st_size &&
+		a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+		a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+static int same_encoding(const char *a, const char *b) {
+	return a == b || (a && b && !strcmp(a, b));
+}
+
+static struct file_cache_entry *find_entry(const char *path, const char *encoding) {
+	struct file_cache_entry *entry = cache.buckets[hash_path(path) & (cache.bucket_count - 1)];
+	while (entry && (strcmp(entry->path, path) || !same_encoding(entry->encoding, encoding))) entry = entry->hash_next;
+	return entry;
+}
+
+static void lru_unlink(struct file_cache_entry *entry) {
+	if (entry->lru_prev) entry->lru_prev->lru_next = entry->lru_next;
+	else cache.lru_head = entry->lru_next;
+	if (entry->lru_next) entry->lru_next->lru_prev = entry->lru_prev;
+	else cache.lru_tail = entry->lru_prev;
+	entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void lru_push_front(struct file_cache_entry *entry) {
+	entry->lru_prev = NULL;
+	entry->lru_next = cache.lru_head;
+	if (cache.lru_head) cache.lru_head->lru_prev = entry;
+	else cache.lru_tail = entry;
+	cache.lru_head = entry;
+}
+
+static void destroy_entry(struct file_cache_entry *entry) {
+	free(entry->path);
+	free(entry->header);
+	free(entry->data);
+	free(entry);
+}
+
+// remove an entry from the cache, it is freed once every response using it is done
+static void evict(struct file_cache_entry *entry) {
+	struct file_cache_entry **link = &cache.buckets[hash_path(entry->path) & (cache.bucket_count - 1)];
+	while (*link != entry) link = &(*link)->hash_next;
+	*link = entry->hash_next;
+	lru_unlink(entry);
+
+	--cache.entry_count;
+	cache.total_size -= entry->size;
+	file_cache_release(entry);
+}
+
+static int grow_buckets(void) {
+	size_t new_count = cache.bucket_count ? cache.bucket_count * 2 : INITIAL_BUCKETS;
+	struct file_cache_entry **new_buckets = calloc(new_count, sizeof(*new_buckets));
+	if (!new_buckets) return -1;
+
+	for (size_t i = 0; i < cache.bucket_count; ++i) {
+		struct file_cache_entry *entry = cache.buckets[i];
+		while (entry) {
+			struct file_cache_entry *next = entry->hash_next;
+			struct file_cache_entry **bucket = &new_buckets[hash_path(entry->path) & (new_count - 1)];
+			entry->hash_next = *bucket;
+			*bucket = entry;
+			entry = next;
+		}
+	}
+
+	free(cache.buckets);
+	cache.buckets = new_buckets;
+	cache.bucket_count = new_count;
+	return 0;
+}
+
+// put a filled in entry into the cache, replacing any older version of it
+static struct file_cache_entry *link_entry(struct file_cache_entry *entry) {
+	entry->header_length = strlen(entry->header);
+	entry->refcount = 2; // one for the cache, one for the caller
+
+	struct file_cache_entry *old = find_entry(entry->path, entry->encoding);
+	if (old) evict(old);
+
+	while (cache.lru_tail && cache.total_size + entry->size > global_config.cache_size) {
+		evict(cache.lru_tail);
+	}
+
+	struct file_cache_entry **bucket = &cache.buckets[hash_path(entry->path) & (cache.bucket_count - 1)];
+	entry->hash_next = *bucket;
+	*bucket = entry;
+	lru_push_front(entry);
+	++cache.entry_count;
+	cache.total_size += entry->size;
+
+	return entry;
+}
+
+int file_cache_eligible(const struct stat *filestat) {
+	return global_config.cache_size && S_ISREG(filestat->st_mode) &&
+		(size_t) filestat->st_size <= global_config.cache_max_file_size &&
+		(size_t) filestat->st_size <= global_config.cache_size;
+}
+
+struct file_cache_entry *file_cache_acquire(const char *path, const char *encoding, const struct stat *filestat) {
+	if (!cache.entry_count) return NULL;
+
+	struct file_cache_entry *entry = find_entry(path, encoding);
+	if (!entry) return NULL;
+
+	// the file changed on disk, so it will have to be read again
+	if (!same_file(&entry->filestat, filestat)) {
+		evict(entry);
+		return NULL;
+	}
+
+	lru_unlink(entry);
+	lru_push_front(entry);
+	++entry->refcount;
+	return entry;
+}
+
+struct file_cache_entry *file_cache_insert(
+	const char *path, const struct stat *filestat, int fd,
+	const char *mime_type, const char *header
+)
+{
+	if (!file_cache_eligible(filestat)) return NULL;
+	if (cache.entry_count >= cache.bucket_count && grow_buckets()) return NULL;
+
+	struct file_cache_entry *entry = calloc(1, sizeof(*entry));
+	if (!entry) return NULL;
+
+	entry->size = filestat->st_size;
+	entry->path = strdup(path);
+	entry->header = strdup(header);
+	entry->data = malloc(entry->size ? entry->size : 1);
+	if (!entry->path || !entry->header || !entry->data) {
+		destroy_entry(entry);
+		return NULL;
+	}
+
+	// don't cache anything that changed size while we were reading it
+	size_t read_len = 0;
+	while (read_len < entry->size) {
+		ssize_t read_res = pread(fd, entry->data + read_len, entry->size - read_len, read_len);
+		if (read_res <= 0) {
+			if (read_res == -1 && errno == EINTR) continue;
+			destroy_entry(entry);
+			return NULL;
+		}
+		read_len += read_res;
+	}
+
+	entry->filestat = *filestat;
+	entry->mime_type = mime_type;
+	return link_entry(entry);
+}
+
+struct file_cache_entry *file_cache_insert_data(
+	const char *path, const char *encoding, const struct stat *filestat,
+	char *data, size_t size, const char *mime_type, const char *header
+)
+{
+	if (!global_config.cache_size || size > global_config.cache_max_file_size || size > global_config.cache_size) return NULL;
+	if (cache.entry_count >= cache.bucket_count && grow_buckets()) return NULL;
+
+	struct file_cache_entry *entry = calloc(1, sizeof(*entry));
+	if (!entry) return NULL;
+
+	entry->path = strdup(path);
+	entry->header = strdup(header);
+	if (!entry->path || !entry->header) {
+		destroy_entry(entry);
+		return NULL;
+	}
+
+	entry->encoding = encoding;
+	entry->data = data;
+	entry->size = size;
+	entry->filestat = *filestat;
+	entry->mime_type = mime_type;
+	return link_entry(entry);
+}
+
+void file_cache_release(struct file_cache_entry *entry) {
+	if (entry && !--entry->refcount) destroy_entry(entry);
+}
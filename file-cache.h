@@ -0,0 +1,98 @@
+/**
+ * @file file-cache.h
+ * @author Will Brown
+ * @brief In-memory cache of small, frequently served files
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026 Will Brown
+ */
+
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <stddef.h>
+
+#include <sys/stat.h>
+
+/**
+ * @brief A cached file
+ * @details Entries are reference counted, so an entry that is evicted while a response
+ * is still sending it stays alive until that response releases it. A file can have one
+ * entry per content encoding, all validated against the status of the original file.
+ */
+struct file_cache_entry {
+    char *path; ///< Path relative to the document root, as found in struct URI
+    const char *encoding; ///< Content encoding of the data, NULL for the file as it is on disk
+    struct stat filestat; ///< File status when the file was cached
+    const char *mime_type; ///< MIME type of the file
+    char *header; ///< Prebuilt header lines describing the file
+    size_t header_length; ///< Length of the prebuilt header lines
+    char *data; ///< Contents of the file
+    size_t size; ///< Size of the file
+    unsigned refcount; ///< Number of users, including the cache itself
+    struct file_cache_entry *hash_next; ///< Next entry in the same hash bucket
+    struct file_cache_entry *lru_prev; ///< More recently used entry
+    struct file_cache_entry *lru_next; ///< Less recently used entry
+};
+
+/**
+ * @brief Check whether a file is small enough to be cached
+ *
+ * @param filestat status of the file
+ * @return 1 if the file may be cached, 0 if not
+ */
+int file_cache_eligible(const struct stat *filestat);
+
+/**
+ * @brief Look up a file in the cache
+ * @details The entry is only returned if the file has not changed since it was cached,
+ * according to the given status. Stale entries are evicted.
+ *
+ * @param path path relative to the document root
+ * @param encoding content encoding to look for, NULL for the file as it is on disk
+ * @param filestat current status of the file
+ * @return the cached entry with a reference held for the caller, or NULL on a miss
+ */
+struct file_cache_entry *file_cache_acquire(const char *path, const char *encoding, const struct stat *filestat);
+
+/**
+ * @brief Read a file into the cache, evicting the least recently used files to make room
+ *
+ * @param path path relative to the document root
+ * @param filestat status of the file
+ * @param fd open file to read from, it is not closed and its offset is not used
+ * @param mime_type MIME type of the file
+ * @param header prebuilt header lines to store with the file
+ * @return the new entry with a reference held for the caller, or NULL on failure
+ */
+struct file_cache_entry *file_cache_insert(
+    const char *path, const struct stat *filestat, int fd,
+    const char *mime_type, const char *header
+);
+
+/**
+ * @brief Store an encoded copy of a file in the cache, evicting the least recently used files to make room
+ *
+ * @param path path relative to the document root
+ * @param encoding content encoding of the data, which must outlive the cache
+ * @param filestat status of the original file
+ * @param data encoded contents, allocated with malloc. The cache takes it over on success.
+ * @param size size of the encoded contents
+ * @param mime_type MIME type of the original file
+ * @param header prebuilt header lines to store with the data
+ * @return the new entry with a reference held for the caller, or NULL on failure
+ */
+struct file_cache_entry *file_cache_insert_data(
+    const char *path, const char *encoding, const struct stat *filestat,
+    char *data, size_t size, const char *mime_type, const char *header
+);
+
+/**
+ * @brief Release a reference to a cache entry
+ *
+ * @param entry the entry to release
+ */
+void file_cache_release(struct file_cache_entry *entry);
+
+#endif // FILE_CACHE_H
@@ -0,0 +1,74 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "file-map.h"
+
+// only files that are being sent right now are mapped, so there are never many
+#define BUCKET_COUNT 64
+
+// one table per event loop, so nothing here needs locking
+static _Thread_local struct file_map *buckets[BUCKET_COUNT];
+
+static size_t bucket_for(const struct stat *filestat) {
+	return ((size_t) filestat->st_ino ^ ((size_t) filestat->st_dev << 7)) % BUCKET_COUNT;
+}
+
+static int same_file(const struct stat *a, const struct stat *b) {
+	return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+		a->st_size == b->st_size &&
+		a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+		a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+struct file_map *file_map_acquire(int fd, const struct stat *filestat) {
+	struct file_map **bucket = &buckets[bucket_for(filestat)];
+	for (struct file_map *map = *bucket; map; map = map->next) {
+		if (same_file(&map->filestat, filestat)) {
+			++map->refcount;
+			return map;
+		}
+	}
+
+	if (filestat->st_size <= 0) return NULL;
+	struct file_map *map = malloc(sizeof(*map));
+	if (!map) return NULL;
+	map->data = mmap(NULL, filestat->st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map->data == MAP_FAILED) {
+		free(map);
+		return NULL;
+	}
+	// responses read the file front to back, so read ahead aggressively and drop pages behind
+	madvise(map->data, filestat->st_size, MADV_SEQUENTIAL);
+
+	map->filestat = *filestat;
+	map->size = filestat->st_size;
+	map->refcount = 1;
+	map->next = *bucket;
+	*bucket = map;
+	return map;
+}
+
+void file_map_prefetch(const struct file_map *map, size_t offset, size_t length) {
+	if (offset >= map->size) return;
+	if (length > map->size - offset) length = map->size - offset;
+
+	// madvise works on whole pages
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	size_t start = offset & ~(page_size - 1);
+	madvise(map->data + start, offset + length - start, MADV_WILLNEED);
+}
+
+void file_map_release(struct file_map *map) {
+	if (!map || --map->refcount) return;
+
+	struct file_map **link = &buckets[bucket_for(&map->filestat)];
+	while (*link != map) link = &(*link)->next;
+	*link = map->next;
+
+	munmap(map->data, map->size);
+	free(map);
+}
@@ -0,0 +1,59 @@
+/**
+ * @file file-map.h
+ * @author Will Brown
+ * @brief Read-only mappings of files, shared by every response sending the same file
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026 Will Brown
+ */
+
+#ifndef FILE_MAP_H
+#define FILE_MAP_H
+
+#include <stddef.h>
+
+#include <sys/stat.h>
+
+/**
+ * @brief A mapped file
+ * @details Mappings are reference counted and unmapped as soon as the last response using
+ * them is done, so they only stay around while the file is actually being sent. A file that
+ * changes gets a new mapping, while responses already sending the old version keep theirs.
+ */
+struct file_map {
+    struct stat filestat; ///< Status of the file when it was mapped
+    char *data; ///< Contents of the file
+    size_t size; ///< Size of the file
+    unsigned refcount; ///< Number of responses using the mapping
+    struct file_map *next; ///< Next mapping in the same hash bucket
+};
+
+/**
+ * @brief Get the mapping of a file, mapping it if nothing else is using it yet
+ * @details Mappings are matched by device, inode, size and modification time, so the same file
+ * is shared no matter which path it was opened through. The fd isn't needed once this returns.
+ *
+ * @param fd open file to map if there is no mapping of it yet
+ * @param filestat current status of the file
+ * @return the mapping with a reference held for the caller, or NULL if it couldn't be mapped
+ */
+struct file_map *file_map_acquire(int fd, const struct stat *filestat);
+
+/**
+ * @brief Start reading part of a mapping from disk before it is sent
+ *
+ * @param map the mapping
+ * @param offset where the part starts
+ * @param length length of the part
+ */
+void file_map_prefetch(const struct file_map *map, size_t offset, size_t length);
+
+/**
+ * @brief Release a reference to a mapping, unmapping it if it was the last one
+ *
+ * @param map the mapping to release, may be NULL
+ */
+void file_map_release(struct file_map *map);
+
+#endif // FILE_MAP_H
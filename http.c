@@ -1,31 +1,41 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <stdint.h>
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
 
-#define __USE_GNU
 #include <dirent.h>
-
-#define __USE_XOPEN
 #include <time.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <linux/openat2.h>
+
+#include <zlib.h>
 
 #include "constants.h"
 #include "config.h"
+#include "access-log.h"
+#include "metrics.h"
 #include "mime-types.h"
+#include "path-cache.h"
 #include "http.h"
 
 // Returns: the index of the string, or -1 upon error.
 static inline ssize_t search_string_enum_table(
-    const char *str, const char **table, size_t size
+    const char *str, size_t len, const char **table, size_t size
 )
 {
     for (ssize_t i = 0; i < (ssize_t) size; ++i) {
-        if (!strcmp(str, table[i])) return i;
+        if (!strncmp(str, table[i], len) && !table[i][len]) return i;
     }
     return -1;
 }
@@ -34,84 +44,270 @@ static inline ssize_t search_string_enum_table(
 
 // TODO: figure out what default locale behavior is
 static char *to_http_date(const time_t t) {
-	static char s[30]; // using a static string. sue me.
+	static _Thread_local char s[30]; // using a static string. sue me. (one per worker, at least)
 	strftime(s, sizeof(s), HTTP_DATE_FMT, gmtime(&t));
 	return s;
 }
 
-static time_t from_http_date(const char s[30]) {
-	struct tm tm;
-	strptime(s, HTTP_DATE_FMT, &tm);
+// Returns 0 if the date can't be parsed
+static time_t from_http_date(const char *s) {
+	struct tm tm = {0};
+	if (!strptime(s, HTTP_DATE_FMT, &tm)) return 0;
 	return timegm(&tm);
 }
 
+/*
+ * Scanning is done a vector at a time where the compiler allows it. Each scan
+ * produces a bitmask with one bit per byte of the vector that matched.
+ */
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SCAN_WIDTH 32
+
+static inline uint32_t scan_eq(const char *p, char c) {
+	__m256i v = _mm256_loadu_si256((const __m256i *) p);
+	return _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)));
+}
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SCAN_WIDTH 16
+
+static inline uint32_t scan_eq(const char *p, char c) {
+	__m128i v = _mm_loadu_si128((const __m128i *) p);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+}
+#endif
+
+// Returns the first occurrence of the character, or end if there is none
+static char *find_char(char *p, char *end, char c) {
+#ifdef SCAN_WIDTH
+	for (; end - p >= SCAN_WIDTH; p += SCAN_WIDTH) {
+		uint32_t mask = scan_eq(p, c);
+		if (mask) return p + __builtin_ctz(mask);
+	}
+#endif
+	while (p < end && *p != c) ++p;
+	return p;
+}
+
+// Returns the length of the header ending in \r\n\r\n, or 0 if the end hasn't been received yet
+static size_t scan_header_end(const char *buf, size_t from, size_t len) {
+	size_t i = from;
+#ifdef SCAN_WIDTH
+	// a match has to fit in one vector, so consecutive vectors overlap by 3 bytes
+	for (; i + SCAN_WIDTH <= len; i += SCAN_WIDTH - 3) {
+		uint32_t cr = scan_eq(buf + i, '\r');
+		uint32_t lf = scan_eq(buf + i, '\n');
+		uint32_t mask = cr & (lf >> 1) & (cr >> 2) & (lf >> 3);
+		if (mask) return i + __builtin_ctz(mask) + 4;
+	}
+#endif
+	for (; i + 4 <= len; ++i) {
+		if (buf[i] == '\r' && !memcmp(buf + i, "\r\n\r\n", 4)) return i + 4;
+	}
+	return 0;
+}
+
+// look for the end of the header, starting where the last search left off
+static int find_header_end(struct sized_buffer *header) {
+	size_t req_len = scan_header_end(header->buf, header->scanned, header->len);
+	if (!req_len) {
+		// the last 3 bytes could be the start of the terminator
+		header->scanned = header->len >= 3 ? header->len - 3 : 0;
+		return 0;
+	}
+	
+	header->req_len = req_len;
+	header->buf[header->req_len - 2] = '\0';
+	return 1;
+}
+
 /*
  * Returns:
  * 1 if recovery is complete
  * 0 if recovery is incomplete
  * -1 if the end of the header is never found after 8KB
+ * -2 if the connection was closed or failed
  */
-int recv_http_header(int fd, struct sized_buffer *header) {
-	ssize_t recv_res;
-    while (header->len < header->cap && (recv_res = recv(fd, header->buf + header->len, header->cap - header->len, 0)) > 0) {
+int recv_http_header(htt_connection_t *conn, struct sized_buffer *header) {
+	// a pipelined request may already be sitting in the buffer
+	if (find_header_end(header)) return 1;
+	
+	ssize_t recv_res = 0;
+    while (header->len < header->cap && (recv_res = htt_connection_recv(conn, header->buf + header->len, header->cap - header->len)) > 0) {
     	header->len += recv_res;
-        if (header->len >= 4 &&
-            // look for the end of the header
-            header->buf[header->len - 4] == '\r' &&
-            header->buf[header->len - 3] == '\n' &&
-            header->buf[header->len - 2] == '\r' &&
-            header->buf[header->len - 1] == '\n')
-        {
-        	header->buf[header->len - 2] = '\0';
-            return 1;
-        }
+        if (find_header_end(header)) return 1;
     }
     
-    return header->len == header->cap ? -1 : 0;
+    if (header->len == header->cap) return -1;
+    if (recv_res == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) return -2;
+    return 0;
 }
 
-static void parse_http_request_entry(struct http_request *req, const char *entry) {
-	char http_date_str[30];
-	if (sscanf(entry, "If-Modified-Since: %29s", http_date_str) == 1) {
-		req->if_modified_since = from_http_date(http_date_str);
-		return;
+void consume_http_header(struct sized_buffer *header) {
+	header->len -= header->req_len;
+	memmove(header->buf, header->buf + header->req_len, header->len);
+	header->req_len = 0;
+	header->scanned = 0;
+}
+
+static const struct {
+	const char *name;
+	size_t len;
+} KNOWN_HEADER_TABLE[HTTP_HEADER_KNOWN_COUNT] = {
+#define KNOWN_HEADER(id, name) [id] = { name, sizeof(name) - 1 }
+	KNOWN_HEADER(HTTP_HEADER_HOST, "Host"),
+	KNOWN_HEADER(HTTP_HEADER_CONNECTION, "Connection"),
+	KNOWN_HEADER(HTTP_HEADER_IF_MODIFIED_SINCE, "If-Modified-Since"),
+	KNOWN_HEADER(HTTP_HEADER_IF_UNMODIFIED_SINCE, "If-Unmodified-Since"),
+	KNOWN_HEADER(HTTP_HEADER_IF_NONE_MATCH, "If-None-Match"),
+	KNOWN_HEADER(HTTP_HEADER_IF_MATCH, "If-Match"),
+	KNOWN_HEADER(HTTP_HEADER_IF_RANGE, "If-Range"),
+	KNOWN_HEADER(HTTP_HEADER_RANGE, "Range"),
+	KNOWN_HEADER(HTTP_HEADER_ACCEPT_ENCODING, "Accept-Encoding"),
+#undef KNOWN_HEADER
+};
+
+// header names are case insensitive, but comparing lengths first rules out almost everything
+static int lookup_known_header(const char *name, size_t len) {
+	for (int i = 0; i < HTTP_HEADER_KNOWN_COUNT; ++i) {
+		if (KNOWN_HEADER_TABLE[i].len == len && !strncasecmp(name, KNOWN_HEADER_TABLE[i].name, len)) return i;
 	}
+	return -1;
 }
 
-struct http_request parse_http_request(char *http_header) {
-    struct http_request res = { .error = 0 };
+static void parse_connection_header(struct http_request *req, const char *value) {
+	// the header is a comma separated list of options
+	while (*value) {
+		value += strspn(value, " \t,");
+		size_t len = strcspn(value, " \t,");
+		if (len == 5 && !strncasecmp(value, "close", len)) req->connection = CONN_CLOSE;
+		else if (len == 10 && !strncasecmp(value, "keep-alive", len)) req->connection = CONN_KEEPALIVE;
+		value += len;
+	}
+}
 
-    char request_type[8];
-    int http_result = sscanf(http_header, "%7s %4095s HTTP/%d.%d\r\n", request_type, res.path, &res.major_version, &res.minor_version);
-    if (http_result == 1) {
-        fprintf(stderr, "URI too long\n");
-        res.error = 414;
-    } else if (http_result != 4) {
-        fprintf(stderr, "Not a valid HTTP header\n");
-        res.error = 400;
-    }
+// Returns the codings the client accepts, ignoring any it gave a weight of 0
+static int parse_accept_encoding(const char *value) {
+	int accepted = 0;
+	while (*value) {
+		value += strspn(value, " \t,");
+		const char *coding = value;
+		size_t len = strcspn(value, " \t,;");
+		const char *item_end = value + strcspn(value, ",");
+		const char *q = memmem(value + len, item_end - value - len, "q=", 2);
+		value = item_end;
+		if (q && strtod(q + 2, NULL) == 0) continue;
+		
+		if (len == 4 && !strncasecmp(coding, "gzip", len)) accepted |= HTTP_ENCODING_GZIP;
+		else if (len == 6 && !strncasecmp(coding, "x-gzip", len)) accepted |= HTTP_ENCODING_GZIP;
+		else if (len == 2 && !strncasecmp(coding, "br", len)) accepted |= HTTP_ENCODING_BR;
+		else if (len == 1 && *coding == '*') accepted |= HTTP_ENCODING_GZIP | HTTP_ENCODING_BR;
+	}
+	return accepted;
+}
 
-    printf("Recieved %s request for path %s using HTTP %d.%d\n", request_type, res.path, res.major_version, res.minor_version);
+// Returns the end of the request line, or NULL if it is malformed
+static char *parse_request_line(struct http_request *req, char *line, char *end) {
+	char *line_end = find_char(line, end, '\n');
+	if (line_end == end) return NULL;
+	char *version_end = line_end > line && line_end[-1] == '\r' ? line_end - 1 : line_end;
+	
+	char *method_end = memchr(line, ' ', version_end - line);
+	if (!method_end) return NULL;
+	char *target = method_end + 1;
+	char *target_end = memchr(target, ' ', version_end - target);
+	if (!target_end || target_end == target) return NULL;
+	
+	const char *REQUEST_TYPE_TABLE[] = {
+		"GET", "HEAD", "POST", "PUT", "DELETE",
+		"CONNECT", "OPTIONS", "TRACE", "PATCH"
+	};
+	
+	req->request_type = search_string_enum_table(line, method_end - line, REQUEST_TYPE_TABLE, sizeof(REQUEST_TYPE_TABLE) / sizeof(REQUEST_TYPE_TABLE[0]));
+	
+	const char *version = target_end + 1;
+	if (version_end - version != 8 || memcmp(version, "HTTP/", 5) ||
+		version[5] < '0' || version[5] > '9' || version[6] != '.' || version[7] < '0' || version[7] > '9')
+	{
+		return NULL;
+	}
+	req->major_version = version[5] - '0';
+	req->minor_version = version[7] - '0';
+	
+	if (target_end - target >= HTTP_PATH_MAX) req->error = 414;
+	*target_end = '\0';
+	req->path = target;
+	req->method = line;
+	req->method_len = method_end - line;
+	
+	return line_end + 1;
+}
 
-    const char *REQUEST_TYPE_TABLE[] = {
-        "GET", "HEAD", "POST", "PUT", "DELETE",
-        "CONNECT", "OPTIONS", "TRACE", "PATCH"
-    };
+// Returns 0 on success, or the status code to respond with
+static int parse_header_field(struct http_request *req, char *line, char *line_end) {
+	char *value_end = line_end > line && line_end[-1] == '\r' ? line_end - 1 : line_end;
+	char *colon = find_char(line, value_end, ':');
+	if (colon == value_end || colon == line) return 400;
+	if (req->header_count == HTTP_MAX_HEADERS) return 431;
+	
+	// strip optional whitespace around the value
+	char *value = colon + 1;
+	while (value < value_end && (*value == ' ' || *value == '\t')) ++value;
+	while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t')) --value_end;
+	*value_end = '\0';
+	
+	struct http_header_field *field = &req->headers[req->header_count++];
+	*field = (struct http_header_field) {
+		.name = line,
+		.name_len = colon - line,
+		.value = value,
+		.value_len = value_end - value
+	};
+	
+	int known = lookup_known_header(field->name, field->name_len);
+	if (known != -1) req->known_headers[known] = field;
+	return 0;
+}
 
-    res.request_type = search_string_enum_table(request_type, REQUEST_TYPE_TABLE, sizeof(REQUEST_TYPE_TABLE) / sizeof(REQUEST_TYPE_TABLE[0]));
+void parse_http_request(struct http_request *req, char *http_header, size_t len) {
+    *req = (struct http_request) { .path = "" };
     
-    // start parsing header entries
-    // skip first line
-    char *saveptr;
-    strtok_r(http_header, "\r\n", &saveptr);
-    {
-    	char *entry;
-    	while ((entry = strtok_r(NULL, "\r\n", &saveptr))) {
-    		parse_http_request_entry(&res, entry);
-    	}
+    // the header ends with an empty line, which recv_http_header has already cut off
+    char *end = http_header + len;
+    char *line = parse_request_line(req, http_header, end);
+    if (!line) {
+        htt_log_error("Not a valid HTTP header");
+        req->error = 400;
+        return;
+    } else if (req->error == 414) {
+        htt_log_error("URI too long");
+        return;
     }
 
-	return res;
+    while (line < end) {
+    	char *line_end = find_char(line, end, '\n');
+    	// continuation lines are obsolete, so just skip them
+    	if (*line != ' ' && *line != '\t') {
+    		int error = parse_header_field(req, line, line_end);
+    		if (error) {
+    			htt_log_error("Not a valid HTTP header");
+    			req->error = error;
+    			return;
+    		}
+    	}
+    	line = line_end + 1;
+    }
+    
+    // HTTP/1.1 connections are persistent unless told otherwise
+    req->connection = req->major_version > 1 || (req->major_version == 1 && req->minor_version >= 1) ?
+    	CONN_KEEPALIVE : CONN_CLOSE;
+    
+    const struct http_header_field *field;
+    if ((field = req->known_headers[HTTP_HEADER_CONNECTION])) parse_connection_header(req, field->value);
+    if ((field = req->known_headers[HTTP_HEADER_IF_MODIFIED_SINCE])) req->if_modified_since = from_http_date(field->value);
+    if ((field = req->known_headers[HTTP_HEADER_IF_UNMODIFIED_SINCE])) req->if_unmodified_since = from_http_date(field->value);
+    if ((field = req->known_headers[HTTP_HEADER_ACCEPT_ENCODING])) req->accept_encoding = parse_accept_encoding(field->value);
 }
 
 // decode hexadecimal characters from string
@@ -140,20 +336,19 @@ static inline int hextoc(const char *s) {
 /*
  * If a buffer is given, the decoded URI is copied into it.
  * This assumes that you know your buffer is large enough for it.
+ * Otherwise, the decoded URI is allocated from the arena.
  */
-static char *decode_percent_encoding(const char *uri, char *buf) {
+static char *decode_percent_encoding(const char *uri, char *buf, struct htt_arena *arena) {
     if (!uri) return NULL;
 
-    int allocated = 0;
     char *r;
     if (!buf) {
-        allocated = 1;
         size_t len = 0;
         for (const char *s = uri; *s; ++len, ++s) {
             if (*s == '%') s += 2;
         }
 
-        r = malloc(len + 1);
+        r = htt_arena_alloc(arena, len + 1);
         if (!r) return NULL;
     } else r = buf;
     
@@ -162,10 +357,7 @@ static char *decode_percent_encoding(const char *uri, char *buf) {
         for (s = r; *uri; ++s, ++uri) {
             if (*uri == '%') {
                 int c = hextoc(++uri);
-                if (c == -1) { // uh oh
-                    if (allocated) free(r);
-                    return NULL;
-                }
+                if (c == -1) return NULL; // uh oh
                 ++uri;
                 if (c) *s = c; // watch out for null chars!
                 else --s;
@@ -177,89 +369,164 @@ static char *decode_percent_encoding(const char *uri, char *buf) {
     return r;
 }
 
-// This mutates the string we give to it, but that's fine.
-static struct URI parse_uri(char *path) {
-	// allocate and zero
-    struct URI ret = {0};
+// the document root, which every file is opened relative to
+static int root_fd = -1;
+static char root_real_path[PATH_MAX];
+static size_t root_real_path_len;
+static int have_openat2 = 1;
+
+// Returns a file descriptor for a path inside dirfd, or -1 with errno set (EXDEV if it escapes)
+static int open_beneath(int dirfd, const char *path, int flags) {
+    if (have_openat2) {
+        struct open_how how = {
+            .flags = flags | O_CLOEXEC,
+            .resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS
+        };
+        int fd = syscall(SYS_openat2, dirfd, path, &how, sizeof(how));
+        if (fd != -1 || errno != ENOSYS) return fd;
+        have_openat2 = 0;
+    }
     
-    if (*path == '/') ++path;
-    char *saveptr;
-    strtok_r(path, "?", &saveptr); // tokenize query
-    if (*path == '\0') path = "index.html"; // path is root
+    // older kernels: walk the path twice, and accept that it can change in between
+    char pathbuf[PATH_MAX];
+    int fd_path = openat(dirfd, path, O_PATH | O_CLOEXEC);
+    if (fd_path == -1) return -1;
+    char proc_path[32];
+    snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", fd_path);
+    ssize_t len = readlink(proc_path, pathbuf, sizeof(pathbuf) - 1);
+    close(fd_path);
+    if (len == -1) return -1;
+    pathbuf[len] = '\0';
+    if (strncmp(pathbuf, root_real_path, root_real_path_len) ||
+        (pathbuf[root_real_path_len] && pathbuf[root_real_path_len] != '/'))
+    {
+        errno = EXDEV;
+        return -1;
+    }
+    return openat(dirfd, path, flags | O_CLOEXEC);
+}
+
+static int open_status(int err) {
+    return err == EXDEV || err == EACCES || err == ELOOP ? 403 : 404;
+}
 
-    // replace passed in path with decoded path
-    char *decoded_path = decode_percent_encoding(path, NULL);
-    if (!decoded_path) {
+// Find the file a request path refers to on disk, without looking at the query.
+// Regular files are left open in the URI. Any strings in the URI are allocated from the arena.
+static struct URI resolve_path(const char *path, struct htt_arena *arena) {
+    struct URI ret = { .fd = -1 };
+
+    // decoding never makes the path longer, so it always fits
+    char decoded_path[HTTP_PATH_MAX];
+    if (!decode_percent_encoding(path, decoded_path, arena)) {
         ret.status = 500;
         return ret;
     }
+    size_t decoded_len = strlen(decoded_path);
+    const char *index = "";
 
-    char pathbuf[4096];
-    char *abs_path = realpath(decoded_path, pathbuf);
-    size_t abs_path_len = abs_path ? strlen(abs_path) : 0;
-    free(decoded_path); // done with that
-    
-    // bad path, or someone is trying to be sneaky...
-    if (!abs_path) {
-    	ret.status = 404;
-    	return ret;
-    } else if (strncmp(abs_path, global_config.root_path, global_config.root_path_len)) {
-    	ret.status = 403;
-    	return ret;
+    // containment and opening happen in the same walk, so nothing can be swapped in between.
+    // O_NONBLOCK keeps a FIFO from hanging the event loop.
+    int fd = open_beneath(root_fd, decoded_path, O_RDONLY | O_NONBLOCK | O_NOCTTY);
+    if (fd == -1 || fstat(fd, &ret.filestat) == -1) {
+        ret.status = fd == -1 ? open_status(errno) : 404;
+        if (fd != -1) close(fd);
+        return ret;
     }
 
-    // Path validity check
-    if (stat(abs_path, &ret.filestat) == -1) {
-        ret.status = 404;
-        return ret;
-    // figure out if the path is a directory
-    } else if (S_ISDIR(ret.filestat.st_mode)) {
+    if (S_ISDIR(ret.filestat.st_mode)) {
     	// do a courtesy redir if there is no / at the end
-    	size_t path_len;
-    	if (global_config.flags & CONFIG_COURTESY_REDIR && path[(path_len = strlen(path)) - 1] != '/') {
+    	size_t path_len = strlen(path);
+    	if (global_config.flags & CONFIG_COURTESY_REDIR && path[path_len - 1] != '/') {
+    		close(fd);
 			// allocate a new string, append '/', and return
-			ret.path = malloc(path_len + 3);
+			ret.path = htt_arena_alloc(arena, path_len + 3);
+			if (!ret.path) {
+				ret.status = 500;
+				return ret;
+			}
 			ret.path[0] = '/';
 			memcpy(ret.path + 1, path, path_len);
 			ret.path[path_len + 1] = '/';
 			ret.path[path_len + 2] = '\0';
 			ret.status = 301;
 			return ret;
-    	} else if (abs_path_len < 4085) {
-            strcpy(abs_path + abs_path_len, "/index.html");
-            
-            if (stat(abs_path, &ret.filestat) == -1) {
-                // remove /index.html so a directory listing can be done instead
-                abs_path[abs_path_len] = '\0';
-                ret.status = URI_FOUND_DIR;
-            } else {
-            	abs_path_len += strlen("/index.html");
-            	ret.status = URI_FOUND_FILE;
-            }
-        } else {
-        	ret.status = 404;
-        	return ret;
-        }
-    } else {
+    	}
+    	
+    	index = "/index.html";
+    	while (decoded_len > 1 && decoded_path[decoded_len - 1] == '/') --decoded_len;
+    	int index_fd = open_beneath(fd, "index.html", O_RDONLY | O_NONBLOCK | O_NOCTTY);
+    	close(fd);
+    	// the directory's own status is kept for listings, which are cached against it
+    	struct stat index_stat;
+    	if (index_fd != -1 && fstat(index_fd, &index_stat) != -1 && S_ISREG(index_stat.st_mode)) {
+    		ret.filestat = index_stat;
+    		ret.fd = index_fd;
+    		ret.status = URI_FOUND_FILE;
+    	} else {
+    		// a directory listing can be done instead
+    		if (index_fd != -1) close(index_fd);
+    		index = "";
+    		ret.status = URI_FOUND_DIR;
+    	}
+    } else if (S_ISREG(ret.filestat.st_mode)) {
+    	ret.fd = fd;
     	ret.status = URI_FOUND_FILE;
+    } else {
+    	// devices, sockets and FIFOs can't be served like files
+    	close(fd);
+    	ret.status = 403;
+    	return ret;
     }
 
-    // copy correct path to new buffer
-    size_t path_len = abs_path_len - global_config.root_path_len;
-    ret.path = malloc(path_len + 1);
+    // the path relative to the document root, with a leading '/'
+    size_t index_len = strlen(index);
+    ret.path = htt_arena_alloc(arena, decoded_len + index_len + 2);
     if (!ret.path) {
+        if (ret.fd != -1) close(ret.fd);
+        ret.fd = -1;
         ret.status = 500;
         return ret;
     }
+    ret.path[0] = '/';
+    memcpy(ret.path + 1, decoded_path, decoded_len);
+    memcpy(ret.path + 1 + decoded_len, index, index_len + 1);
+    return ret;
+}
+
+// This mutates the string we give to it, but that's fine.
+// Any strings in the URI are allocated from the arena.
+static struct URI parse_uri(char *path, struct htt_arena *arena) {
+    struct URI ret;
     
-    strncpy(ret.path, pathbuf + global_config.root_path_len, path_len);
-    ret.path[path_len] = '\0';
+    if (*path == '/') ++path;
+    char *saveptr;
+    strtok_r(path, "?", &saveptr); // tokenize query
+    if (*path == '\0') path = "index.html"; // path is root
+
+    const struct path_cache_entry *cached = path_cache_lookup(path);
+    if (cached) {
+        htt_metrics_add(HTT_METRIC_PATH_CACHE_HITS, 1);
+        ret = (struct URI) { .filestat = cached->filestat, .status = cached->status, .fd = -1, .cache_key = path };
+        if (cached->path && !(ret.path = htt_arena_strndup(arena, cached->path, strlen(cached->path)))) {
+            ret.status = 500;
+        }
+    } else {
+        htt_metrics_add(HTT_METRIC_PATH_CACHE_MISSES, 1);
+        ret = resolve_path(path, arena);
+        // a 500 means we ran out of memory or got a bad escape, neither of which says anything about the disk
+        if (ret.status != 500) path_cache_insert(path, ret.path, &ret.filestat, ret.status);
+    }
+
+    // errors and redirects don't need the query
+    if (ret.status >= 100) return ret;
 
     // decode query
     char *query = strtok_r(NULL, "?", &saveptr);
     if (query) {
-        ret.query = decode_percent_encoding(query, NULL);
+        ret.query = decode_percent_encoding(query, NULL, arena);
         if (!ret.query) {
+            if (ret.fd != -1) close(ret.fd);
+            ret.fd = -1;
             ret.status = 500;
             return ret;
         }
@@ -268,70 +535,280 @@ static struct URI parse_uri(char *path) {
     return ret;
 }
 
-static void destroy_uri(struct URI *uri) {
-	if (uri->path) free(uri->path);
-	if (uri->query) free(uri->query);
+static const struct {
+    int status;
+    const char *str;
+} HTTP_STATUS_TABLE[] = {
+    {200, "OK"},
+    {206, "Partial Content"},
+    {301, "Moved Permanently"},
+    {304, "Not Modified"},
+    {400, "Bad Request"},
+    {403, "Forbidden"},
+    {404, "Not Found"},
+    {412, "Precondition Failed"},
+    {414, "URI Too Long"},
+    {416, "Range Not Satisfiable"},
+    {431, "Request Header Fields Too Large"},
+    {500, "Internal Server Error"},
+    {501, "Not Implemented"}
+};
+
+#define HTTP_STATUS_COUNT (sizeof(HTTP_STATUS_TABLE) / sizeof(HTTP_STATUS_TABLE[0]))
+
+static ssize_t http_status_index(int status) {
+    for (size_t i = 0; i < HTTP_STATUS_COUNT; ++i) {
+        if (HTTP_STATUS_TABLE[i].status == status) return i;
+    }
+    return -1;
 }
 
-static const char *http_status_str(int status) {
-    switch (status) {
-        case 200: return "OK";
-        case 301: return "Moved Permanently";
-        case 304: return "Not Modified";
-        case 400: return "Bad Request";
-        case 403: return "Forbidden";
-        case 404: return "Not Found";
-        case 414: return "URI Too Long";
-        case 500: return "Internal Server Error";
-        case 501: return "Not Implemented";
-        default: return "Internal Server Error";
+const char *http_status_str(int status) {
+    ssize_t i = http_status_index(status);
+    return i != -1 ? HTTP_STATUS_TABLE[i].str : "Internal Server Error";
+}
+
+/**
+ * @brief A header line that is rendered ahead of time
+ */
+struct prerendered_line {
+    char str[64];
+    size_t len;
+};
+
+// everything after "HTTP/x.y" on the status line, rendered by http_init
+static struct prerendered_line status_lines[HTTP_STATUS_COUNT];
+static struct prerendered_line cache_control_line;
+
+int http_init(void) {
+    root_fd = open(global_config.root_path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd == -1 || !realpath(global_config.root_path, root_real_path)) {
+        fprintf(stderr, "Failed to open document root %s: %s\n", global_config.root_path, strerror(errno));
+        return -1;
+    }
+    root_real_path_len = strlen(root_real_path);
+    
+    for (size_t i = 0; i < HTTP_STATUS_COUNT; ++i) {
+        status_lines[i].len = snprintf(
+            status_lines[i].str, sizeof(status_lines[i].str), " %d %s\r\n",
+            HTTP_STATUS_TABLE[i].status, HTTP_STATUS_TABLE[i].str
+        );
+    }
+    
+    cache_control_line.len = snprintf(
+        cache_control_line.str, sizeof(cache_control_line.str),
+        "Cache-Control: max-age=%d\r\n", global_config.max_age
+    );
+    return 0;
+}
+
+// The Date line only changes once a second, so each event loop keeps its own copy
+static const struct prerendered_line *date_line(void) {
+    static _Thread_local struct prerendered_line line;
+    static _Thread_local time_t rendered_at = -1;
+    
+    time_t now = time(NULL);
+    if (now != rendered_at) {
+        line.len = snprintf(line.str, sizeof(line.str), "Date: %s\r\n", to_http_date(now));
+        rendered_at = now;
+    }
+    
+    return &line;
+}
+
+/*
+ * Headers are assembled with memcpy into a buffer of HTTP_HEADER_MAX bytes.
+ * Anything that doesn't fit leaves len past HTTP_HEADER_MAX, so the caller can tell
+ * the header overflowed instead of sending it cut off.
+ */
+static inline void header_append(char *buf, size_t *len, const char *s, size_t n) {
+    if (*len > HTTP_HEADER_MAX || n > HTTP_HEADER_MAX - *len) {
+        *len = HTTP_HEADER_MAX + 1;
+        return;
     }
+    memcpy(buf + *len, s, n);
+    *len += n;
 }
 
+#define header_append_literal(buf, len, s) header_append(buf, len, s, sizeof(s) - 1)
 
+static inline void header_append_str(char *buf, size_t *len, const char *s) {
+    header_append(buf, len, s, strlen(s));
+}
 
-static void create_header(struct http_response *res) {
-    const char *CONN_TYPE_TABLE[] = {"close", "keep-alive"};
+static void header_append_uint(char *buf, size_t *len, unsigned long n) {
+    char digits[20];
+    size_t i = sizeof(digits);
+    do {
+        digits[--i] = '0' + n % 10;
+        n /= 10;
+    } while (n);
+    header_append(buf, len, digits + i, sizeof(digits) - i);
+}
+
+// header lines describing the file being served
+static void append_file_header(char *buf, size_t *len, const struct http_response *res) {
+    // if there is none, just don't send a mime type
+    header_append_literal(buf, len, "Content-Type: ");
+    if (res->mime_type) header_append_str(buf, len, res->mime_type);
+    header_append_literal(buf, len, "\r\n");
+    
+    if (res->content_encoding) {
+        header_append_literal(buf, len, "Content-Encoding: ");
+        header_append_str(buf, len, res->content_encoding);
+        header_append_literal(buf, len, "\r\n");
+    }
+    if (res->vary_encoding) header_append_literal(buf, len, "Vary: Accept-Encoding\r\n");
+    
+    // only send content length if the response has a body, and it's known up front
+    if (res->stream) {
+        if (res->stream->chunked) header_append_literal(buf, len, "Transfer-Encoding: chunked\r\n");
+    } else if (http_response_has_content(res)) {
+        header_append_literal(buf, len, "Content-Length: ");
+        header_append_uint(buf, len, res->content_length);
+        header_append_literal(buf, len, "\r\n");
+    }
+    
+    if (res->status == 206 && !res->multipart_ranges) {
+        header_append_literal(buf, len, "Content-Range: bytes ");
+        header_append_uint(buf, len, res->content_offset);
+        header_append_literal(buf, len, "-");
+        header_append_uint(buf, len, res->content_offset + res->content_length - 1);
+        header_append_literal(buf, len, "/");
+        header_append_uint(buf, len, res->uri.filestat.st_size);
+        header_append_literal(buf, len, "\r\n");
+    } else if (res->status == 416) {
+        header_append_literal(buf, len, "Content-Range: bytes */");
+        header_append_uint(buf, len, res->uri.filestat.st_size);
+        header_append_literal(buf, len, "\r\n");
+    }
+    
+    // ranges are only served of the file as it is on disk
+    if (res->uri.status == URI_FOUND_FILE && res->status < 400 && !res->content_encoding) {
+        header_append_literal(buf, len, "Accept-Ranges: bytes\r\n");
+    }
     
-    FILE *fp = open_memstream(&res->header_buf, &res->header_length);
-    if (!fp) {
-    	res->status = 501;
-    	return;
+    if (res->etag[0] && res->status < 400) {
+        header_append_literal(buf, len, "ETag: ");
+        header_append_str(buf, len, res->etag);
+        header_append_literal(buf, len, "\r\n");
     }
+    
+    // only send last modified if not an error page, or something that was never a file
+    if (res->status < 400 && res->uri.status != URI_METRICS) {
+        time_t mtime = res->encoded_stat.st_ino ? res->encoded_stat.st_mtime : res->uri.filestat.st_mtime;
+        header_append_literal(buf, len, "Last-Modified: ");
+        header_append_str(buf, len, to_http_date(mtime));
+        header_append_literal(buf, len, "\r\n");
+    }
+}
 
-    fprintf(
-        fp,
-        "HTTP/%d.%d %d %s\r\n"
-        "Content-Type: %s\r\n"
-        "Connection: %s\r\n"
-        "Date: %s\r\n",
-        res->major_version, res->minor_version, res->status, http_status_str(res->status),
-        res->mime_type ? res->mime_type : "", // if there is none, just don't send a mime type
-        CONN_TYPE_TABLE[res->connection], to_http_date(time(NULL))
-    );
+// Returns 0 on success, -1 if the header didn't fit or couldn't be allocated
+static int create_header(struct http_response *res, struct htt_arena *arena) {
+    // assemble the header in scratch space, then copy only what was used into the arena
+    static _Thread_local char buf[HTTP_HEADER_MAX];
+    size_t *len = &res->header_length;
+    *len = 0;
     
-    // only send content length if the response has a body
-    if (res->content)
-    	fprintf(fp, "Content-Length: %ld\r\n", res->content_length);
+    header_append_literal(buf, len, "HTTP/");
+    header_append_uint(buf, len, res->major_version);
+    header_append_literal(buf, len, ".");
+    header_append_uint(buf, len, res->minor_version);
+    ssize_t status_index = http_status_index(res->status);
+    if (status_index != -1) {
+        header_append(buf, len, status_lines[status_index].str, status_lines[status_index].len);
+    } else {
+        header_append_literal(buf, len, " ");
+        header_append_uint(buf, len, res->status);
+        header_append_literal(buf, len, " Internal Server Error\r\n");
+    }
     
-    // only send last modified if not an error page
-    if (res->status < 400)
-    	fprintf(fp, "Last-Modified: %s\r\n", to_http_date(res->uri.filestat.st_mtime));
+    if (res->connection == CONN_KEEPALIVE) header_append_literal(buf, len, "Connection: keep-alive\r\n");
+    else header_append_literal(buf, len, "Connection: close\r\n");
     
-    if (res->status >= 300 && res->status != 304 && res->status < 400)
-    	fprintf(fp, "Location: %s\r\n", res->uri.path);
+    const struct prerendered_line *date = date_line();
+    header_append(buf, len, date->str, date->len);
     
-    if (res->status <= 500)
-    	fprintf(fp, "Cache-Control: max-age=%d\r\n", global_config.max_age);
+    // the cached lines describe the whole file
+    if (res->cache_entry && res->status == 200) header_append(buf, len, res->cache_entry->header, res->cache_entry->header_length);
+    else append_file_header(buf, len, res);
     
-    fputs("\r\n", fp);
-    fclose(fp);
+    if (res->status >= 300 && res->status != 304 && res->status < 400) {
+        header_append_literal(buf, len, "Location: ");
+        header_append_str(buf, len, res->uri.path);
+        header_append_literal(buf, len, "\r\n");
+    }
+    
+    if (res->uri.status == URI_METRICS) header_append_literal(buf, len, "Cache-Control: no-store\r\n");
+    else if (res->status <= 500) header_append(buf, len, cache_control_line.str, cache_control_line.len);
+    
+    header_append_literal(buf, len, "\r\n");
+    
+    res->header_buf = *len <= HTTP_HEADER_MAX ? htt_arena_alloc(arena, *len) : NULL;
+    if (!res->header_buf) {
+        *len = 0;
+        return -1;
+    }
+    memcpy(res->header_buf, buf, *len);
+    return 0;
+}
+
+// Renders the header lines describing a file, to be kept in the cache with it.
+// Returns 0 on success, -1 if they didn't fit.
+static int render_file_header(const struct http_response *res, char header[HTTP_HEADER_MAX + 1]) {
+    size_t header_length = 0;
+    append_file_header(header, &header_length, res);
+    if (header_length > HTTP_HEADER_MAX) return -1;
+    header[header_length] = '\0';
+    return 0;
+}
+
+// read a small file into the cache along with the header lines describing it
+static void cache_file(struct http_response *res) {
+    char header[HTTP_HEADER_MAX + 1];
+    if (render_file_header(res, header)) return;
+    
+    res->cache_entry = file_cache_insert(res->uri.path, &res->uri.filestat, res->content_fd, res->mime_type, header);
+    if (res->cache_entry) {
+    	close(res->content_fd);
+    	res->content_fd = -1;
+    }
+}
+
+// how much of a mapped file is read ahead before the first send
+#define MAP_PREFETCH_SIZE (1 << 20)
+
+// send the content from a mapping shared with every other response sending the same file,
+// instead of each response going through its own fd
+static void map_file(struct http_response *res) {
+    // the fd may be a precompressed copy rather than the file the URI resolved to
+    struct stat st;
+    if (fstat(res->content_fd, &st) == -1) return;
+    res->file_map = file_map_acquire(res->content_fd, &st);
+    if (!res->file_map) return;
+    
+    // the file changed since the length was worked out, so the mapping may not cover it
+    if (res->file_map->size < res->content_offset + res->content_length) {
+        file_map_release(res->file_map);
+        res->file_map = NULL;
+        return;
+    }
+    close(res->content_fd);
+    res->content_fd = -1;
+    file_map_prefetch(
+        res->file_map, res->content_offset,
+        res->content_length < MAP_PREFETCH_SIZE ? res->content_length : MAP_PREFETCH_SIZE
+    );
 }
 
 static void create_error_page(struct http_response *res, const char *path) {
-    res->content = open_memstream(&res->content_buf, &res->content_length);
+    // the page replaces whatever was going to be sent
+    res->mime_type = "text/html";
+    res->vary_encoding = 0;
+    FILE *fp = open_memstream(&res->content_buf, &res->content_length);
+    if (!fp) return;
     fprintf(
-    	res->content,
+    	fp,
 		"<!DOCTYPE html>"
 		"<html>"
 			"<head>"
@@ -344,42 +821,667 @@ static void create_error_page(struct http_response *res, const char *path) {
 		"</html>",
 		res->status, http_status_str(res->status), path
 	);
-    fflush(res->content);
+    fclose(fp);
 }
 
-static void create_dir_listing(struct http_response *res) {
-	fprintf(
-		res->content,
-		"<!DOCTYPE html>"
-		"<html>"
-			"<head>"
-				"<title>Index of %1$s</title>"
-			"</head>"
-			"<body>"
-				"<h1>Index of %1$s</h1>",
-		res->uri.path
-	);
-	
+// the page of a directory listing asked for with ?page=N, counting from 1
+static size_t listing_page(const char *query) {
+	const char *param = query;
+	while (param && strncmp(param, "page=", 5)) {
+		param = strchr(param, '&');
+		if (param) ++param;
+	}
+	if (!param) return 1;
+	size_t page = strtoul(param + 5, NULL, 10);
+	return page ? page : 1;
+}
+
+// pages after the first are cached under the directory's path with the page appended.
+// Only a file with that exact name could collide, and the cache would tell them apart by inode.
+static void listing_cache_key(char *key, size_t size, const char *path, size_t page) {
+	if (page == 1) snprintf(key, size, "%s", path);
+	else snprintf(key, size, "%s?page=%zu", path, page);
+}
+
+// generated bodies are produced in pieces of this size, which fits any single line of a listing
+#define STREAM_PIECE_SIZE 16384
+// room in front of each piece for its chunk size line
+#define STREAM_FRAME_RESERVE 16
+
+// Start streaming a generated body. Returns 0 on success, -1 if there was no memory for it.
+static int start_stream(
+    struct http_response *res, ssize_t (*produce)(struct http_response *, char *, size_t),
+    void (*destroy)(struct http_response *), void *state
+) {
+    struct http_body_stream *stream = htt_arena_alloc(res->arena, sizeof(*stream));
+    char *buf = htt_arena_alloc(res->arena, STREAM_FRAME_RESERVE + STREAM_PIECE_SIZE + 2);
+    if (!stream || !buf) return -1;
+    *stream = (struct http_body_stream) {
+        .produce = produce,
+        .destroy = destroy,
+        .state = state,
+        .chunked = res->major_version > 1 || (res->major_version == 1 && res->minor_version >= 1),
+        .buf = buf
+    };
+    // without chunks, closing the connection is the only way to show where the body ends
+    if (!stream->chunked) res->connection = CONN_CLOSE;
+    res->stream = stream;
+    return 0;
+}
+
+int http_stream_next(struct http_response *res) {
+    struct http_body_stream *stream = res->stream;
+    char *data = stream->buf + STREAM_FRAME_RESERVE;
+    ssize_t len = stream->produce(res, data, STREAM_PIECE_SIZE);
+    if (len < 0) return -1;
+    
+    if (!len) {
+        stream->finished = 1;
+        stream->pos = stream->end = 0;
+        if (stream->chunked) {
+            memcpy(stream->buf, "0\r\n\r\n", 5);
+            stream->end = 5;
+        }
+        return 0;
+    }
+    
+    stream->pos = STREAM_FRAME_RESERVE;
+    stream->end = STREAM_FRAME_RESERVE + len;
+    if (stream->chunked) {
+        // the size line goes in the space left in front of the data, so the chunk is sent in one piece
+        char size_line[STREAM_FRAME_RESERVE];
+        int size_len = snprintf(size_line, sizeof(size_line), "%zx\r\n", (size_t) len);
+        stream->pos -= size_len;
+        memcpy(stream->buf + stream->pos, size_line, size_len);
+        memcpy(stream->buf + stream->end, "\r\n", 2);
+        stream->end += 2;
+    }
+    return 0;
+}
+
+enum dir_listing_part { LISTING_HEAD, LISTING_ENTRIES, LISTING_FOOT, LISTING_DONE };
+
+// what a directory listing being streamed has left to send
+struct dir_listing {
 	struct dirent **namelist;
-	int n = scandir(res->uri.path + 1, &namelist, NULL, versionsort);
-	if (n > 0) {
-		for (int i = 0; i < n; ++i) {
-			fprintf(res->content, "<a href=\"%1$s/%2$s\">%2$s</a><br>", res->uri.path, namelist[i]->d_name);
-			free(namelist[i]);
+	size_t count; ///< Entries in namelist, of every page
+	size_t next; ///< Next entry to send
+	size_t last; ///< One past the last entry on this page
+	size_t page;
+	size_t page_count;
+	enum dir_listing_part part;
+	const char *cache_key; ///< Key to cache the listing under once it is complete, NULL if it won't be
+	char *copy; ///< Everything sent so far, kept for the cache
+	size_t copy_len;
+	size_t copy_cap;
+};
+
+// keep a finished listing, validated by the directory's inode and modification time like a file
+static void cache_dir_listing(struct http_response *res, struct dir_listing *listing) {
+    // the header in the cache describes the listing as a whole, not the chunks it was sent in
+    struct http_response whole = *res;
+    whole.stream = NULL;
+    whole.content_buf = listing->copy;
+    whole.content_length = listing->copy_len;
+    char header[HTTP_HEADER_MAX + 1];
+    if (render_file_header(&whole, header)) return;
+    
+    struct file_cache_entry *entry = file_cache_insert_data(
+        listing->cache_key, NULL, &res->uri.filestat, listing->copy, listing->copy_len, res->mime_type, header
+    );
+    if (entry) {
+        listing->copy = NULL;
+        file_cache_release(entry);
+    }
+}
+
+static void keep_listing_copy(struct dir_listing *listing, const char *buf, size_t len) {
+	if (!listing->cache_key) return;
+	size_t need = listing->copy_len + len;
+	if (need > global_config.cache_max_file_size) {
+		// too big to be cached, so don't hold on to it
+		listing->cache_key = NULL;
+		return;
+	}
+	if (need > listing->copy_cap) {
+		size_t cap = listing->copy_cap ? listing->copy_cap : STREAM_PIECE_SIZE;
+		while (cap < need) cap *= 2;
+		char *copy = realloc(listing->copy, cap);
+		if (!copy) {
+			listing->cache_key = NULL;
+			return;
+		}
+		listing->copy = copy;
+		listing->copy_cap = cap;
+	}
+	memcpy(listing->copy + listing->copy_len, buf, len);
+	listing->copy_len = need;
+}
+
+// Writes as many whole parts of the listing as fit
+static ssize_t produce_dir_listing(struct http_response *res, char *buf, size_t size) {
+	struct dir_listing *listing = res->stream->state;
+	size_t len = 0;
+	
+	while (listing->part != LISTING_DONE) {
+		int n = 0;
+		if (listing->part == LISTING_HEAD) {
+			n = snprintf(
+				buf + len, size - len,
+				"<!DOCTYPE html>"
+				"<html>"
+					"<head>"
+						"<title>Index of %1$s</title>"
+					"</head>"
+					"<body>"
+						"<h1>Index of %1$s</h1>",
+				res->uri.path
+			);
+		} else if (listing->part == LISTING_ENTRIES) {
+			if (listing->next == listing->last) {
+				listing->part = LISTING_FOOT;
+				continue;
+			}
+			const char *name = listing->namelist[listing->next]->d_name;
+			n = snprintf(buf + len, size - len, "<a href=\"%1$s/%2$s\">%2$s</a><br>", res->uri.path, name);
+		} else if (listing->page_count > 1) {
+			char previous[64] = "", next[64] = "";
+			if (listing->page > 1) snprintf(previous, sizeof(previous), " <a href=\"?page=%zu\">Previous</a>", listing->page - 1);
+			if (listing->page < listing->page_count) snprintf(next, sizeof(next), " <a href=\"?page=%zu\">Next</a>", listing->page + 1);
+			n = snprintf(
+				buf + len, size - len, "<p>Page %zu of %zu%s%s</p></body></html>",
+				listing->page, listing->page_count, previous, next
+			);
+		} else {
+			n = snprintf(buf + len, size - len, "</body></html>");
 		}
-		free(namelist);
-	} else {
-		fprintf(res->content, "<p>Error creating directory listing: %s</p>", strerror(errno));
+		
+		// a part that doesn't fit waits for the next piece, unless it couldn't fit in any
+		if (n < 0 || (size_t) n >= size - len) {
+			if (n < 0 || !len) return -1;
+			break;
+		}
+		len += n;
+		if (listing->part == LISTING_ENTRIES) ++listing->next;
+		else ++listing->part;
+	}
+	
+	keep_listing_copy(listing, buf, len);
+	if (!len && listing->cache_key) cache_dir_listing(res, listing);
+	return len;
+}
+
+static void destroy_dir_listing(struct http_response *res) {
+	struct dir_listing *listing = res->stream->state;
+	for (size_t i = 0; i < listing->count; ++i) free(listing->namelist[i]);
+	free(listing->namelist);
+	free(listing->copy);
+}
+
+// Starts streaming a page of a directory listing, which is cached under key once it's complete.
+// Returns 0 on success, or the status to respond with instead.
+static int start_dir_listing(struct http_response *res, size_t page, const char *key) {
+	struct dir_listing *listing = htt_arena_alloc(res->arena, sizeof(*listing));
+	if (!listing) return 500;
+	*listing = (struct dir_listing) { .page = page, .part = LISTING_HEAD };
+	
+	int n = scandirat(root_fd, res->uri.path + 1, &listing->namelist, NULL, versionsort);
+	if (n < 0) return 500;
+	listing->count = n;
+	
+	size_t page_size = global_config.dir_listing_page_size ? global_config.dir_listing_page_size : listing->count;
+	listing->page_count = listing->count > page_size ? (listing->count + page_size - 1) / page_size : 1;
+	listing->next = (page - 1) * page_size;
+	listing->last = page <= listing->page_count && listing->count - listing->next > page_size ?
+		listing->next + page_size : listing->count;
+	
+	// A listing made in the same second as the last change to the directory may already be
+	// out of date without the time changing again, so it isn't kept.
+	if (global_config.cache_size && res->uri.filestat.st_mtime < time(NULL) - 1) {
+		listing->cache_key = htt_arena_strndup(res->arena, key, strlen(key));
 	}
 	
-	fprintf(res->content, "</body></html>");
-	fflush(res->content);
+	int status = page > listing->page_count ? 404 : 0;
+	if (!status && start_stream(res, &produce_dir_listing, &destroy_dir_listing, listing)) status = 500;
+	if (status) {
+		for (size_t i = 0; i < listing->count; ++i) free(listing->namelist[i]);
+		free(listing->namelist);
+	}
+	return status;
+}
+
+// the query is ignored, so scrapers can add whatever they like to it
+static int is_metrics_path(const char *path) {
+	if (!global_config.metrics_path) return 0;
+	size_t len = strcspn(path, "?");
+	return !strncmp(path, global_config.metrics_path, len) && !global_config.metrics_path[len];
+}
+
+static void create_metrics_page(struct http_response *res, const char *path) {
+	FILE *fp = open_memstream(&res->content_buf, &res->content_length);
+	if (!fp) {
+		res->status = 500;
+		create_error_page(res, path);
+		return;
+	}
+	htt_metrics_render(fp);
+	fclose(fp);
+	res->status = 200;
+	res->mime_type = "text/plain; version=0.0.4";
+}
+
+static const char *file_mime_type(const char *path) {
+	const char *ext = get_file_ext(path);
+	return ext ? lookup_mime_type(ext) : NULL;
+}
+
+/*
+ * Files get a strong entity tag made from their inode, size and modification time, with the
+ * content coding appended for encoded copies. A precompressed copy can be replaced without the
+ * file changing, so its own size and modification time follow the coding. Directory listings
+ * only get a weak tag, since their output can change without the directory itself changing.
+ */
+static void set_etag(struct http_response *res) {
+    const struct stat *st = &res->uri.filestat;
+    int len = snprintf(
+        res->etag, sizeof(res->etag), "%s\"%lx-%lx-%lx.%lx%s%s",
+        res->uri.status == URI_FOUND_DIR ? "W/" : "",
+        (unsigned long) st->st_ino, (unsigned long) st->st_size,
+        (unsigned long) st->st_mtim.tv_sec, (unsigned long) st->st_mtim.tv_nsec,
+        res->content_encoding ? "-" : "", res->content_encoding ? res->content_encoding : ""
+    );
+    
+    const struct stat *enc = &res->encoded_stat;
+    if (res->content_encoding && enc->st_ino) {
+        len += snprintf(
+            res->etag + len, sizeof(res->etag) - len, ".%lx-%lx.%lx",
+            (unsigned long) enc->st_size, (unsigned long) enc->st_mtim.tv_sec, (unsigned long) enc->st_mtim.tv_nsec
+        );
+    }
+    snprintf(res->etag + len, sizeof(res->etag) - len, "\"");
+}
+
+// every page of a listing is a representation of its own, so each gets its own tag
+static void set_listing_etag(struct http_response *res, size_t page) {
+    set_etag(res);
+    if (page == 1) return;
+    size_t len = strlen(res->etag);
+    snprintf(res->etag + len - 1, sizeof(res->etag) - len + 1, ".p%zu\"", page);
 }
 
-struct http_response *create_response(struct http_request *req) {
-    struct http_response *res = calloc(1, sizeof(*res));
+/*
+ * Returns the tag in a list that matches the response's entity tag, or NULL if none do.
+ * Tags for any content coding of the same version of the file match, since the encoding
+ * isn't chosen until after the preconditions pass. A strong comparison never matches weak tags.
+ */
+static const char *find_matching_etag(const char *list, const char *etag, int strong, size_t *match_len) {
+    int etag_weak = !strncmp(etag, "W/", 2);
+    if (etag_weak) etag += 2;
+    size_t base_len = strlen(etag) - 1; // leave off the closing quote
+    
+    while (*list) {
+        list += strspn(list, " \t,");
+        const char *tag = list;
+        if (*list == '*') {
+            *match_len = 0;
+            return list;
+        }
+        
+        int weak = !strncmp(list, "W/", 2);
+        if (weak) list += 2;
+        if (*list != '"') return NULL;
+        const char *end = strchr(list + 1, '"');
+        if (!end) return NULL;
+        
+        size_t len = end - list;
+        if (!(strong && (weak || etag_weak)) && len >= base_len && !strncmp(list, etag, base_len) &&
+            (len == base_len || list[base_len] == '-'))
+        {
+            *match_len = end + 1 - tag;
+            return tag;
+        }
+        list = end + 1;
+    }
+    return NULL;
+}
+
+// Returns 0 if the request should go ahead, or the status to respond with instead
+static int evaluate_preconditions(struct http_response *res, const struct http_request *req) {
+    const struct http_header_field *field;
+    time_t mtime = res->uri.filestat.st_mtime;
+    size_t match_len;
+    
+    if ((field = req->known_headers[HTTP_HEADER_IF_MATCH])) {
+        if (!find_matching_etag(field->value, res->etag, 1, &match_len)) return 412;
+    } else if (req->if_unmodified_since && mtime > req->if_unmodified_since) {
+        return 412;
+    }
+    
+    if ((field = req->known_headers[HTTP_HEADER_IF_NONE_MATCH])) {
+        const char *match = find_matching_etag(field->value, res->etag, 0, &match_len);
+        if (!match) return 0;
+        // the 304 carries the tag the client has, which may be for an encoded copy
+        if (match_len && match_len < sizeof(res->etag)) {
+            memcpy(res->etag, match, match_len);
+            res->etag[match_len] = '\0';
+        }
+        return 304;
+    } else if (req->if_modified_since && mtime <= req->if_modified_since) {
+        return 304;
+    }
+    
+    return 0;
+}
+
+// Returns the file being served, which stays in uri.fd, or -1 with errno set if it couldn't be opened
+static int open_file(struct http_response *res) {
+    if (res->uri.fd != -1) return res->uri.fd;
+    
+    // the path cache may hand back an older status, so get it again from what was opened
+    res->uri.fd = open_beneath(root_fd, res->uri.path + 1, O_RDONLY | O_NONBLOCK | O_NOCTTY);
+    if (res->uri.fd != -1 && fstat(res->uri.fd, &res->uri.filestat) == -1) {
+        int err = errno;
+        close(res->uri.fd);
+        res->uri.fd = -1;
+        errno = err;
+    }
+    return res->uri.fd;
+}
+
+// Returns a precompressed copy of the file that is at least as new as it, or -1 if there is none
+static int open_precompressed(struct http_response *res, const char *ext) {
+    // most files have no precompressed copies, so their absence goes in the path cache.
+    // Request paths never contain '?', so these keys can't be mistaken for one.
+    char key[HTTP_PATH_MAX + 8];
+    if ((size_t) snprintf(key, sizeof(key), "?%s%s", res->uri.path + 1, ext) >= sizeof(key)) return -1;
+    if (path_cache_lookup(key)) return -1;
+    const char *path = key + 1;
+    
+    int fd = open_beneath(root_fd, path, O_RDONLY | O_NONBLOCK | O_NOCTTY);
+    if (fd == -1) {
+        if (errno == ENOENT || errno == ENOTDIR) path_cache_insert(key, NULL, &res->uri.filestat, 404);
+        return -1;
+    }
+    
+    struct stat st;
+    const struct timespec *orig = &res->uri.filestat.st_mtim;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_mtim.tv_sec < orig->tv_sec ||
+        (st.st_mtim.tv_sec == orig->tv_sec && st.st_mtim.tv_nsec < orig->tv_nsec))
+    {
+        close(fd);
+        return -1;
+    }
+    
+    res->encoded_stat = st;
+    res->content_length = st.st_size;
+    return fd;
+}
+
+#define GZIP_LEVEL 6
+
+// gzip a small file and keep the result in the cache. Returns 1 on success, 0 to send the file as it is.
+static int compress_file(struct http_response *res) {
+    int fd = open_file(res);
+    if (fd == -1 || !file_cache_eligible(&res->uri.filestat)) return 0;
+    
+    size_t size = res->uri.filestat.st_size;
+    char *data = malloc(size ? size : 1);
+    if (!data) return 0;
+    for (size_t read_len = 0; read_len < size;) {
+        ssize_t read_res = pread(fd, data + read_len, size - read_len, read_len);
+        if (read_res <= 0) {
+            if (read_res == -1 && errno == EINTR) continue;
+            free(data);
+            return 0;
+        }
+        read_len += read_res;
+    }
+    
+    // a window of 15 bits plus 16 asks zlib for a gzip wrapper
+    z_stream zs = {0};
+    if (deflateInit2(&zs, GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(data);
+        return 0;
+    }
+    size_t bound = deflateBound(&zs, size);
+    char *out = malloc(bound);
+    zs.next_in = (Bytef *) data;
+    zs.avail_in = size;
+    zs.next_out = (Bytef *) out;
+    zs.avail_out = bound;
+    int deflate_res = out ? deflate(&zs, Z_FINISH) : Z_MEM_ERROR;
+    size_t out_len = zs.total_out;
+    deflateEnd(&zs);
+    free(data);
+    
+    // not worth it if it didn't get any smaller
+    if (deflate_res != Z_STREAM_END || out_len >= size) {
+        free(out);
+        return 0;
+    }
+    
+    htt_metrics_add(HTT_METRIC_CACHE_MISSES, 1);
+    res->content_encoding = "gzip";
+    set_etag(res);
+    res->content_length = out_len;
+    res->content_buf = out;
+    char header[HTTP_HEADER_MAX + 1];
+    if (!render_file_header(res, header)) {
+        res->cache_entry = file_cache_insert_data(
+            res->uri.path, res->content_encoding, &res->uri.filestat, out, out_len, res->mime_type, header
+        );
+    }
+    // if it couldn't be cached, it is sent from the response's own buffer
+    if (res->cache_entry) res->content_buf = NULL;
+    return 1;
+}
+
+// Returns 1 if the response was set up with a compressed body, 0 to send the file as it is
+static int find_encoded_content(struct http_response *res, int accepted) {
+    // in order of preference
+    static const struct {
+        int flag;
+        const char *name;
+        const char *ext;
+    } ENCODINGS[] = {
+        { HTTP_ENCODING_BR, "br", ".br" },
+        { HTTP_ENCODING_GZIP, "gzip", ".gz" }
+    };
+    
+#define ENCODING_COUNT (sizeof(ENCODINGS) / sizeof(ENCODINGS[0]))
+    
+    // memory first, so a cached copy doesn't cost a failed open for every request
+    for (size_t i = 0; i < ENCODING_COUNT; ++i) {
+        if (!(accepted & ENCODINGS[i].flag)) continue;
+        if ((res->cache_entry = file_cache_acquire(res->uri.path, ENCODINGS[i].name, &res->uri.filestat))) {
+            htt_metrics_add(HTT_METRIC_CACHE_HITS, 1);
+            res->content_encoding = ENCODINGS[i].name;
+            res->content_length = res->cache_entry->size;
+            set_etag(res);
+            return 1;
+        }
+    }
+    
+    for (size_t i = 0; i < ENCODING_COUNT; ++i) {
+        if (!(accepted & ENCODINGS[i].flag)) continue;
+        if ((res->content_fd = open_precompressed(res, ENCODINGS[i].ext)) != -1) {
+            res->content_encoding = ENCODINGS[i].name;
+            set_etag(res);
+            return 1;
+        }
+    }
+    
+#undef ENCODING_COUNT
+    
+    // brotli is only served precompressed
+    return accepted & HTTP_ENCODING_GZIP ? compress_file(res) : 0;
+}
+
+#define HTTP_MAX_RANGES 16
+// multiple ranges adding up to more than this are sent as one range covering all of them
+#define MULTIPART_MAX (256 << 10)
+
+struct byte_range {
+    size_t start;
+    size_t length;
+};
+
+// Returns the number of satisfiable ranges, 0 if none are, or -1 if the header should be ignored
+static int parse_range_header(const char *value, size_t size, struct byte_range *ranges) {
+    if (strncasecmp(value, "bytes=", 6)) return -1;
+    value += 6;
+    
+    int specs = 0, count = 0;
+    while (*value) {
+        value += strspn(value, " \t,");
+        if (!*value) break;
+        
+        char *end;
+        size_t start, last;
+        if (*value == '-') {
+            // the last n bytes
+            if (value[1] < '0' || value[1] > '9') return -1;
+            size_t suffix = strtoull(value + 1, &end, 10);
+            start = suffix < size ? size - suffix : 0;
+            last = suffix && size ? size - 1 : 0;
+            if (!suffix || !size) start = size;
+        } else {
+            if (*value < '0' || *value > '9') return -1;
+            start = strtoull(value, &end, 10);
+            if (*end != '-') return -1;
+            if (end[1] >= '0' && end[1] <= '9') {
+                last = strtoull(end + 1, &end, 10);
+                if (last < start) return -1;
+            } else {
+                last = SIZE_MAX;
+                ++end;
+            }
+            if (last >= size) last = size - 1;
+        }
+        
+        value = end + strspn(end, " \t");
+        if (*value && *value != ',') return -1;
+        if (++specs > HTTP_MAX_RANGES) return -1;
+        if (start < size) ranges[count++] = (struct byte_range) { start, last - start + 1 };
+    }
+    
+    return specs ? count : -1;
+}
+
+// If-Range has to match exactly, and only strong tags of the file as it is on disk ever do
+static int if_range_matches(const struct http_request *req, const struct http_response *res) {
+    const struct http_header_field *field = req->known_headers[HTTP_HEADER_IF_RANGE];
+    if (!field) return 1;
+    if (!strncmp(field->value, "W/", 2)) return 0;
+    if (field->value[0] == '"') return !strcmp(field->value, res->etag);
+    return from_http_date(field->value) == res->uri.filestat.st_mtime;
+}
+
+static void drop_content(struct http_response *res) {
+    if (res->content_fd != -1) close(res->content_fd);
+    res->content_fd = -1;
+    file_cache_release(res->cache_entry);
+    res->cache_entry = NULL;
+    file_map_release(res->file_map);
+    res->file_map = NULL;
+    free(res->content_buf);
+    res->content_buf = NULL;
+    if (res->stream && res->stream->destroy) res->stream->destroy(res);
+    res->stream = NULL;
+}
+
+// Returns 1 if the ranges were copied into a multipart/byteranges body, 0 on failure
+static int create_multipart_body(
+    struct http_response *res, const struct byte_range *ranges, int count, struct htt_arena *arena
+)
+{
+    char boundary[24];
+    snprintf(boundary, sizeof(boundary), "htt-%016llx", (unsigned long long) (htt_metrics_now() ^ (uintptr_t) res));
+    char *mime_type = htt_arena_alloc(arena, sizeof("multipart/byteranges; boundary=") + sizeof(boundary));
+    if (!mime_type) return 0;
+    sprintf(mime_type, "multipart/byteranges; boundary=%s", boundary);
+    
+    char *buf;
+    size_t len;
+    FILE *fp = open_memstream(&buf, &len);
+    if (!fp) return 0;
+    
+    int ok = 1;
+    for (int i = 0; ok && i < count; ++i) {
+        fprintf(
+            fp, "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %zu-%zu/%zu\r\n\r\n",
+            boundary, res->mime_type ? res->mime_type : "application/octet-stream",
+            ranges[i].start, ranges[i].start + ranges[i].length - 1, res->content_length
+        );
+        if (res->cache_entry) {
+            fwrite(res->cache_entry->data + ranges[i].start, 1, ranges[i].length, fp);
+            continue;
+        }
+        
+        char chunk[16384];
+        for (size_t copied = 0; ok && copied < ranges[i].length;) {
+            size_t want = ranges[i].length - copied < sizeof(chunk) ? ranges[i].length - copied : sizeof(chunk);
+            ssize_t read_res = pread(res->content_fd, chunk, want, ranges[i].start + copied);
+            if (read_res == -1 && errno == EINTR) continue;
+            if (read_res <= 0) ok = 0;
+            else copied += fwrite(chunk, 1, read_res, fp);
+        }
+    }
+    fprintf(fp, "\r\n--%s--\r\n", boundary);
+    
+    if (fclose(fp) || !ok) {
+        free(buf);
+        return 0;
+    }
+    
+    drop_content(res);
+    res->content_buf = buf;
+    res->content_length = len;
+    res->mime_type = mime_type;
+    res->multipart_ranges = 1;
+    return 1;
+}
+
+// Turn a 200 response for a whole file into a 206 or 416 if the client asked for part of it
+static void apply_ranges(struct http_response *res, const struct http_request *req, struct htt_arena *arena) {
+    struct byte_range ranges[HTTP_MAX_RANGES];
+    int count = parse_range_header(req->known_headers[HTTP_HEADER_RANGE]->value, res->content_length, ranges);
+    if (count == -1) return;
+    
+    if (!count) {
+        drop_content(res);
+        res->status = 416;
+        res->content_length = 0;
+        create_error_page(res, req->path);
+        return;
+    }
+    
+    if (count > 1) {
+        size_t total = 0, start = SIZE_MAX, end = 0;
+        for (int i = 0; i < count; ++i) {
+            total += ranges[i].length;
+            if (ranges[i].start < start) start = ranges[i].start;
+            if (ranges[i].start + ranges[i].length > end) end = ranges[i].start + ranges[i].length;
+        }
+        if (total <= MULTIPART_MAX && create_multipart_body(res, ranges, count, arena)) {
+            res->status = 206;
+            return;
+        }
+        ranges[0] = (struct byte_range) { start, end - start };
+    }
+    
+    res->status = 206;
+    res->content_offset = ranges[0].start;
+    res->content_length = ranges[0].length;
+}
+
+struct http_response *create_response(struct http_request *req, struct htt_arena *arena) {
+    htt_arena_mark_t mark = htt_arena_mark(arena);
+    struct http_response *res = htt_arena_alloc(arena, sizeof(*res));
     if (!res) return NULL;
     *res = (struct http_response) {
+        .arena = arena,
+        .arena_mark = mark,
         .connection = CONN_CLOSE,
         .mime_type = "text/html", // mime type of error pages
         .header_length = 0,
@@ -387,58 +1489,110 @@ struct http_response *create_response(struct http_request *req) {
         .header_buf = NULL,
         .content_length = 0,
         .content_sent = 0,
-        .content_buf = NULL
+        .content_buf = NULL,
+        .stream = NULL,
+        .content_fd = -1,
+        .splice_pipe = {-1, -1},
+        .uri.fd = -1,
+        .method = req->method,
+        .method_len = req->method_len,
+        .request_path = req->path,
+        .request_major_version = req->major_version,
+        .request_minor_version = req->minor_version
     };
 
     if (req->error) {
         res->major_version = 1;
         res->minor_version = 1;
         res->status = req->error;
+        res->uri.status = req->error;
     } else {
         res->major_version = req->major_version;
         res->minor_version = req->minor_version;
-        res->uri = parse_uri(req->path);
+        if (is_metrics_path(req->path)) {
+            res->uri.status = URI_METRICS;
+        } else {
+            uint64_t parse_start_ns = htt_metrics_now();
+            res->uri = parse_uri(req->path, arena);
+            htt_metrics_observe(HTT_STAGE_PARSE_URI, htt_metrics_now() - parse_start_ns);
+        }
     }
 
     switch (req->request_type) {
         case HTTP_GET: {
-            res->connection = CONN_CLOSE;
+            // we can't trust where the next request starts after a malformed one
+            if (!req->error) res->connection = req->connection;
             switch (res->uri.status) {
             	case URI_FOUND_FILE: {
-        			const char *ext = get_file_ext(res->uri.path);
-	                res->mime_type = ext ? lookup_mime_type(ext) : NULL;
-	                if (res->uri.filestat.st_atime < req->if_modified_since) {
+	                res->mime_type = file_mime_type(res->uri.path);
+	                res->vary_encoding = global_config.flags & CONFIG_COMPRESSION && mime_type_compressible(res->mime_type);
+	                set_etag(res);
+	                // ranges are always of the file as it is on disk
+	                int want_range = req->known_headers[HTTP_HEADER_RANGE] && if_range_matches(req, res);
+	                int precondition = evaluate_preconditions(res, req);
+	                if (precondition == 412) {
+	                	res->status = 412;
+	                	create_error_page(res, req->path);
+	                } else if (precondition == 304) {
 	                	res->status = 304;
+	                } else if (res->vary_encoding && req->accept_encoding && !want_range && find_encoded_content(res, req->accept_encoding)) {
+	                	res->status = 200;
+	                } else if ((res->cache_entry = file_cache_acquire(res->uri.path, NULL, &res->uri.filestat))) {
+	                	htt_metrics_add(HTT_METRIC_CACHE_HITS, 1);
+	                	res->status = 200;
+	                	res->content_length = res->cache_entry->size;
 	                } else {
 		        		res->status = 200;
-		        		res->content = fopen(res->uri.path + 1, "r");
-		        		if (res->content) {
+		        		res->content_fd = open_file(res);
+		        		res->uri.fd = -1;
+		        		if (res->content_fd != -1) {
+		        			// the file may have been statted again when it was opened
+		        			set_etag(res);
 				        	res->content_length = res->uri.filestat.st_size;
+				        	if (file_cache_eligible(&res->uri.filestat)) {
+				        		htt_metrics_add(HTT_METRIC_CACHE_MISSES, 1);
+				        		cache_file(res);
+				        	}
 				        } else {
-				        	res->status = 500;
+				        	// the file was removed or locked away since its path was cached
+				        	res->status = open_status(errno);
+				        	if (res->uri.cache_key) path_cache_invalidate(res->uri.cache_key);
 				        	create_error_page(res, req->path);
-				        }	                
+				        }
 	                }
+	                if (want_range && res->status == 200) apply_ranges(res, req, arena);
+	                if (global_config.flags & CONFIG_MMAP_FILES && res->content_fd != -1) map_file(res);
             	} break;
             	case URI_FOUND_DIR: {
             		if (global_config.flags & CONFIG_DIR_LISTING) {
-            			if (res->uri.filestat.st_atime < req->if_modified_since) {
+            			size_t page = listing_page(res->uri.query);
+            			char key[HTTP_PATH_MAX + 32];
+            			listing_cache_key(key, sizeof(key), res->uri.path, page);
+            			set_listing_etag(res, page);
+            			int precondition = evaluate_preconditions(res, req);
+            			if (precondition == 412) {
+            				res->status = 412;
+            				create_error_page(res, req->path);
+            			} else if (precondition == 304) {
 			            	res->status = 304;
+			            } else if ((res->cache_entry = file_cache_acquire(key, NULL, &res->uri.filestat))) {
+			            	htt_metrics_add(HTT_METRIC_CACHE_HITS, 1);
+			            	res->status = 200;
+			            	res->content_length = res->cache_entry->size;
 			            } else {
-				    		res->status = 200;
-				    		res->content = open_memstream(&res->content_buf, &res->content_length);
-				    		if (res->content) {
-				    			create_dir_listing(res);
-				    		} else {
-				    			res->status = 500;
-						    	create_error_page(res, req->path);
-				    		}			            
+			            	htt_metrics_add(HTT_METRIC_CACHE_MISSES, 1);
+			            	int error = start_dir_listing(res, page, key);
+			            	res->status = error ? error : 200;
+			            	if (error) create_error_page(res, req->path);
 			            }
             		} else {
             			res->status = 404;
             			create_error_page(res, req->path);
             		}
             	} break;
+            	case URI_METRICS: {
+            		create_metrics_page(res, req->path);
+            	} break;
             	default: {
             		res->status = res->uri.status;
 	                create_error_page(res, req->path);
@@ -451,14 +1605,39 @@ struct http_response *create_response(struct http_request *req) {
         }
     }
 
-    create_header(res);
+    // a file that was resolved but not sent, because of a 304, the file cache or the method
+    if (res->uri.fd != -1) {
+        close(res->uri.fd);
+        res->uri.fd = -1;
+    }
+
+    if (create_header(res, arena)) {
+        // a header that doesn't fit can't be sent cut off, so send a plain error page instead
+        drop_content(res);
+        res->status = 500;
+        res->content_offset = 0;
+        res->multipart_ranges = 0;
+        res->content_encoding = NULL;
+        res->encoded_stat.st_ino = 0;
+        create_error_page(res, req->path);
+        if (create_header(res, arena)) {
+            destroy_response(res);
+            return NULL;
+        }
+    }
     return res;
 }
 
 void destroy_response(struct http_response *res) {
     if (!res) return;
-	destroy_uri(&res->uri);
-	if (res->content) fclose(res->content);
+	if (res->content_fd != -1) close(res->content_fd);
+	if (res->splice_pipe[0] != -1) {
+		close(res->splice_pipe[0]);
+		close(res->splice_pipe[1]);
+	}
 	if (res->content_buf) free(res->content_buf);
-	free(res);
+	if (res->stream && res->stream->destroy) res->stream->destroy(res);
+	file_cache_release(res->cache_entry);
+	file_map_release(res->file_map);
+	htt_arena_release(res->arena, res->arena_mark);
 }
@@ -12,11 +12,17 @@
 #define HTTP_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include <limits.h>
 
+#include <sys/types.h>
 #include <sys/stat.h>
 
 #include "constants.h"
+#include "arena.h"
+#include "connection.h"
+#include "file-cache.h"
+#include "file-map.h"
 
 /**
  * @brief Structure for a HTTP header
@@ -24,21 +30,41 @@
 struct sized_buffer {
 	size_t cap; ///< Capacity of the buffer
     size_t len; ///< Actual length of the buffer
+    size_t req_len; ///< Length of the first complete header in the buffer, 0 if not found yet
+    size_t scanned; ///< How far the buffer has been searched for the end of the header
+    uint64_t recv_start_ns; ///< Monotonic time the first part of the current request was read
     char buf[]; ///< Buffer max 8192 bytes
 };
 
 /**
- * @brief Recover HTTP header from a socket.
+ * @brief Open the document root and render the parts of response headers that only depend on the configuration
+ * @details Call this once after the configuration is loaded, before any responses are created.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int http_init(void);
+
+/**
+ * @brief Recover HTTP header from a connection.
  * @details This will recover chunks of the header until there is no more to recover.
  * Keep calling this until you get a nonzero return value.
+ * Anything received past the end of the header (pipelined requests) is left in the buffer after req_len.
  *
- * @param fd file descriptor of the socket
+ * @param conn connection to receive from
  * @param header pointer to the header in memory
  * @return 1 if recovery is complete,
  * 0 if recovery is incomplete,
- * -1 if the end of the header is never found after 8KB
+ * -1 if the end of the header is never found after 8KB,
+ * -2 if the connection was closed or failed
+ */
+int recv_http_header(htt_connection_t *conn, struct sized_buffer *header);
+
+/**
+ * @brief Discard the request at the start of a buffer, keeping any pipelined requests after it
+ *
+ * @param header the buffer to shift
  */
-int recv_http_header(int fd, struct sized_buffer *header);
+void consume_http_header(struct sized_buffer *header);
 
 /**
  * @brief enumeration of the types of HTTP requests
@@ -48,36 +74,82 @@ enum http_request_type {
     HTTP_CONNECT, HTTP_OPTIONS, HTTP_TRACE, HTTP_PATCH
 };
 
+/**
+ * @brief Type of HTTP connection.
+ */
+enum connection_type { CONN_CLOSE, CONN_KEEPALIVE };
+
+/**
+ * @brief Content codings a response body can be sent with, as a bitmask
+ */
+enum http_content_encoding { HTTP_ENCODING_GZIP = 1, HTTP_ENCODING_BR = 2 };
+
+#define HTTP_MAX_HEADERS 64
+
+/**
+ * @brief Headers that are looked up directly instead of searching the whole list
+ */
+enum http_header_id {
+    HTTP_HEADER_HOST,
+    HTTP_HEADER_CONNECTION,
+    HTTP_HEADER_IF_MODIFIED_SINCE,
+    HTTP_HEADER_IF_UNMODIFIED_SINCE,
+    HTTP_HEADER_IF_NONE_MATCH,
+    HTTP_HEADER_IF_MATCH,
+    HTTP_HEADER_IF_RANGE,
+    HTTP_HEADER_RANGE,
+    HTTP_HEADER_ACCEPT_ENCODING,
+    HTTP_HEADER_KNOWN_COUNT
+};
+
+/**
+ * @brief A header field, pointing into the request buffer
+ */
+struct http_header_field {
+    const char *name; ///< Name of the field, not null terminated
+    size_t name_len; ///< Length of the name
+    const char *value; ///< Value of the field with surrounding whitespace removed, null terminated
+    size_t value_len; ///< Length of the value
+};
+
 /**
  * @brief Structure for a HTTP request
+ * @details Strings point into the buffer the request was parsed from, so they are only
+ * valid until it is consumed.
  */
 struct http_request {
-    char path[HTTP_PATH_MAX]; ///< Path given in the request
+    char *path; ///< Path given in the request
+    const char *method; ///< Method as it was sent, not null terminated
+    size_t method_len; ///< Length of the method
     enum http_request_type request_type; ///< Type of request
     int major_version; ///< Major HTTP version
     int minor_version; ///< Minor HTTP version
-    time_t if_modified_since; ///< If-Modified-Since header
+    time_t if_modified_since; ///< If-Modified-Since header, 0 if not sent or invalid
+    time_t if_unmodified_since; ///< If-Unmodified-Since header, 0 if not sent or invalid
+    enum connection_type connection; ///< Connection header, or the default for the HTTP version
+    int accept_encoding; ///< http_content_encoding values allowed by the Accept-Encoding header
     int error; ///< Error code for the HTTP request (if applicable)
+    size_t header_count; ///< Number of header fields
+    struct http_header_field headers[HTTP_MAX_HEADERS]; ///< Header fields in the order they were sent
+    const struct http_header_field *known_headers[HTTP_HEADER_KNOWN_COUNT]; ///< Known header fields, NULL if not sent
 };
 
 /**
  * @brief Parse a HTTP header into a http_request struct
+ * @details The header is split up in place, so it must stay around as long as the request.
+ * The known headers point into the struct itself, so it is filled in where it lives rather than returned.
  *
- * @param http_header string containing the HTTP header
- * @return struct containing the HTTP request
- */
-struct http_request parse_http_request(char *http_header);
-
-/**
- * @brief Type of HTTP connection.
+ * @param req the request to fill in
+ * @param http_header buffer containing the HTTP header
+ * @param len length of the header, up to the empty line that ends it
  */
-enum connection_type { CONN_CLOSE, CONN_KEEPALIVE };
+void parse_http_request(struct http_request *req, char *http_header, size_t len);
 
 /**
  * @brief Status enum for URI parsing. Anything >= 100 is a HTTP status code.
  */
 enum URI_status {
-	URI_FOUND_FILE, URI_FOUND_DIR
+	URI_FOUND_FILE, URI_FOUND_DIR, URI_METRICS
 };
 
 /**
@@ -87,9 +159,30 @@ struct URI {
     char *path; ///< Actual file to serve, or location in case of a redir.
     char *query; ///< Query to process in server (currently unused)
     struct stat filestat; ///< File status (kept for multiple uses)
+    int fd; ///< The file, if it was opened while resolving the path, or -1
+    const char *cache_key; ///< Path cache key the URI was found under, NULL if it was resolved just now
     int status; ///< Status code for parsing URI. Can be either a URI_status enum or HTTP status code.
 };
 
+struct http_response;
+
+/**
+ * @brief A response body that is generated a piece at a time while it is sent
+ * @details The producer is only asked for the next piece once the last one has been
+ * written to the socket, so a slow client pauses it and only one piece is held in memory.
+ * On HTTP/1.1 the pieces are sent as chunks, on HTTP/1.0 the body ends when the connection closes.
+ */
+struct http_body_stream {
+    ssize_t (*produce)(struct http_response *res, char *buf, size_t size); ///< Writes up to size bytes of the body, returns how many, 0 at the end or -1 on failure
+    void (*destroy)(struct http_response *res); ///< Frees whatever the producer holds, may be NULL
+    void *state; ///< Producer's own state
+    int chunked; ///< The body is sent with the chunked transfer coding
+    int finished; ///< The producer has nothing more to give
+    char *buf; ///< The piece being sent, with its chunk framing
+    size_t pos; ///< Start of what is left to send in buf
+    size_t end; ///< End of what is left to send in buf
+};
+
 /**
  * @brief Structure for a HTTP response
  */
@@ -100,25 +193,76 @@ struct http_response {
     enum connection_type connection; ///< Type of connection
     struct URI uri; ///< URI of the file to serve
     const char *mime_type; ///< MIME type of the file
+    const char *content_encoding; ///< Content coding of the body, NULL if it is sent as it is on disk
+    struct stat encoded_stat; ///< Status of the precompressed copy being sent, st_ino is 0 if there is none
+    int vary_encoding; ///< The body depends on Accept-Encoding
+    char etag[128]; ///< Entity tag of the body, including quotes, empty if there is none
     size_t header_length; ///< Length of the header section of the response
     size_t header_sent; ///< Number of bytes of the header sent
     char *header_buf; ///< Header data
     size_t content_length; ///< Length of the content section of the response
     size_t content_sent; ///< Number of bytes of content sent
-    char *content_buf; ///< Buffer for memory streams
-    FILE *content; ///< stdio FILE pointer to the content
+    size_t content_offset; ///< Where the content starts in the file or cached data, for range requests
+    int multipart_ranges; ///< The content is a multipart/byteranges body built in content_buf
+    char *content_buf; ///< Buffer for generated content (error pages, directory listings)
+    struct http_body_stream *stream; ///< Producer of the content if it is streamed, NULL otherwise
+    int content_fd; ///< File descriptor of the file to serve, or -1 if the content is buffered
+    int splice_pipe[2]; ///< Pipe used when sendfile is unavailable, or -1 if unused
+    size_t splice_pipe_len; ///< Number of bytes of content sitting in the pipe
+    struct sized_buffer *request_buf; ///< Buffer the request came from, reused for the next request on keep-alive
+    struct htt_arena *arena; ///< Arena the response and its strings were allocated from
+    htt_arena_mark_t arena_mark; ///< Position of the arena before the response was created
+    struct file_cache_entry *cache_entry; ///< Cached file being served from memory, if any
+    struct file_map *file_map; ///< Mapping of the file the content is sent from, if any
+    const char *method; ///< Method of the request, for logging, NULL if it couldn't be parsed
+    size_t method_len; ///< Length of the method
+    const char *request_path; ///< Path of the request, for logging
+    int request_major_version; ///< HTTP version the request was sent with
+    int request_minor_version;
+    uint64_t start_ns; ///< Monotonic time the request was received at
+    uint64_t send_start_ns; ///< Monotonic time the response was ready to send
 };
 
+/**
+ * @brief Get the reason phrase for a status code
+ *
+ * @param status HTTP status
+ * @return the reason phrase, or "Internal Server Error" for unknown codes
+ */
+const char *http_status_str(int status);
+
+/**
+ * @brief Check whether a response has a body to send
+ *
+ * @param res the response to check
+ * @return nonzero if there is a body
+ */
+static inline int http_response_has_content(const struct http_response *res) {
+    return res->content_buf || res->content_fd != -1 || res->cache_entry || res->file_map || res->stream;
+}
+
+/**
+ * @brief Ask the producer of a streamed body for its next piece
+ * @details Only call this once everything between pos and end has been sent.
+ * When the producer is done, the piece is whatever ends the body and finished is set.
+ *
+ * @param res the response being streamed
+ * @return 0 on success, -1 if the producer failed and the body can't be completed
+ */
+int http_stream_next(struct http_response *res);
+
 /**
  * @brief Create a http_response struct from a http_request struct
  *
  * @param req the request to use
+ * @param arena the arena to allocate the response from
  * @return the response for your request
  */
-struct http_response *create_response(struct http_request *req);
+struct http_response *create_response(struct http_request *req, struct htt_arena *arena);
 
 /**
  * @brief Free all memory associated with a http_response struct
+ * @details Everything allocated from the arena since the response was created is released at once.
  *
  * @param res the response to free
  */
@@ -1,43 +1,44 @@
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
 #include <signal.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/epoll.h>
 
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #include "config.h"
+#include "access-log.h"
 #include "connection.h"
+#include "http.h"
 #include "mime-types.h"
 
-// this will accept arguments some day...
-int main(int, char *argv[]) {
-	load_default_config();
-	
-	for (char **arg = argv + 1; *arg; ++arg) parse_config_option(*arg);
-	
-	load_mime_type_list();
-
-	int server_fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+// Returns the listening socket, or -1 on failure
+static int create_listener(void) {
+	int server_fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
 	if (server_fd == -1) {
 		fprintf(stderr, "Failed to create socket: %s\n", strerror(errno));
-		return 1;
+		return -1;
 	}
 
-    // Connections will have a 2 minute timeout for both send and receive
-    {
-		struct timeval timeout = {
-			.tv_sec = 120,
-			.tv_usec = 0
-		};
-		
-		setsockopt(server_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(struct timeval));
-		setsockopt(server_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(struct timeval));
-    }
+	// every worker binds its own socket, and the kernel balances connections between them
+	{
+		int one = 1;
+		setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == -1) {
+			fprintf(stderr, "Failed to set SO_REUSEPORT: %s\n", strerror(errno));
+			close(server_fd);
+			return -1;
+		}
+	}
 
 	// Bind IP address
 	{
@@ -49,19 +50,84 @@ int main(int, char *argv[]) {
 
 		if (bind(server_fd, (struct sockaddr *) &sa, sizeof(sa)) == -1) {
 			fprintf(stderr, "Failed to bind socket: %s\n", strerror(errno));
-			return 1;
+			close(server_fd);
+			return -1;
+		}
+	}
+
+	// both only speed things up, so the server still runs if the kernel refuses them
+	if (global_config.defer_accept) {
+		int secs = global_config.defer_accept;
+		if (setsockopt(server_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &secs, sizeof(secs)) == -1) {
+			fprintf(stderr, "Failed to set TCP_DEFER_ACCEPT: %s\n", strerror(errno));
+		}
+	}
+	if (global_config.tcp_fastopen > 0) {
+		int qlen = global_config.tcp_fastopen;
+		if (setsockopt(server_fd, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof(qlen)) == -1) {
+			fprintf(stderr, "Failed to set TCP_FASTOPEN: %s\n", strerror(errno));
 		}
 	}
 
-	if (listen(server_fd, 128) == -1) {
+	if (listen(server_fd, global_config.listen_backlog) == -1) {
 		fprintf(stderr, "Failed to listen to socket: %s\n", strerror(errno));
-		return 1;
+		close(server_fd);
+		return -1;
 	}
-	
-	htt_server_init(server_fd);
-	while (!htt_server_poll());
+
+	return server_fd;
+}
+
+// Runs a single event loop until it fails
+static void *worker_main(void *arg) {
+	long id = (long) arg;
+
+	if (global_config.flags & CONFIG_CPU_AFFINITY) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(id % sysconf(_SC_NPROCESSORS_ONLN), &set);
+		int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if (err) fprintf(stderr, "Failed to set affinity of worker %ld: %s\n", id, strerror(err));
+	}
+
+	int server_fd = create_listener();
+	if (server_fd == -1) exit(1);
+
+	htt_server_t server;
+	if (htt_server_init(&server, server_fd)) exit(1);
+	while (!htt_server_poll(&server));
 
 	// if for some reason we fail to poll, PANIC AND DIE
-	fprintf(stderr, "Unrecoverable error, server closing.\n");
+	fprintf(stderr, "Unrecoverable error in worker %ld, server closing.\n", id);
+	exit(1);
+}
+
+// this will accept arguments some day...
+int main(int, char *argv[]) {
+	load_default_config();
+
+	for (char **arg = argv + 1; *arg; ++arg) parse_config_option(*arg);
+
+	load_mime_type_list();
+	if (http_init()) return 1;
+	if (htt_log_start()) return 1;
+
+	// sendfile can't be told not to raise SIGPIPE, so ignore it globally
+	signal(SIGPIPE, SIG_IGN);
+
+	long workers = global_config.workers > 0 ? global_config.workers : sysconf(_SC_NPROCESSORS_ONLN);
+
+	// the main thread runs worker 0
+	for (long id = 1; id < workers; ++id) {
+		pthread_t thread;
+		int err = pthread_create(&thread, NULL, &worker_main, (void *) id);
+		if (err) {
+			fprintf(stderr, "Failed to start worker %ld: %s\n", id, strerror(err));
+			return 1;
+		}
+		pthread_detach(thread);
+	}
+
+	worker_main((void *) 0);
 	return 1;
 }
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "http.h"
+#include "metrics.h"
+
+#define STATUS_MIN 100
+#define STATUS_MAX 599
+
+// every power of two is split into four buckets, which is plenty for latencies
+#define SUB_BITS 2
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - SUB_BITS + 1) * SUB_BUCKETS)
+
+// bucket boundaries shown to Prometheus: 1us (2^10ns) up to about 17s (2^34ns)
+#define EXPORT_MIN_EXP 10
+#define EXPORT_MAX_EXP 34
+
+struct stage_histogram {
+	uint64_t sum_ns;
+	uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+struct loop_metrics {
+	int registered;
+	uint64_t counters[HTT_METRIC_COUNTER_COUNT];
+	uint64_t status[STATUS_MAX - STATUS_MIN + 1];
+	struct stage_histogram stages[HTT_STAGE_COUNT];
+	struct loop_metrics *next; ///< loops are never removed, so the list can be walked without the lock
+};
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct loop_metrics *registry;
+
+// one per event loop, living as long as its thread does
+static _Thread_local struct loop_metrics local;
+
+static struct loop_metrics *get_local(void) {
+	if (!local.registered) {
+		local.registered = 1;
+		pthread_mutex_lock(&registry_lock);
+		local.next = registry;
+		__atomic_store_n(&registry, &local, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&registry_lock);
+	}
+	return &local;
+}
+
+// only the owning event loop writes, so a plain load and store is enough, while still
+// letting the reader see whole values
+static inline void add_relaxed(uint64_t *p, uint64_t n) {
+	__atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t load_relaxed(const uint64_t *p) {
+	return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static unsigned bucket_index(uint64_t v) {
+	if (v < SUB_BUCKETS) return v;
+	unsigned exp = 63 - __builtin_clzll(v);
+	unsigned shift = exp - SUB_BITS;
+	return (shift + 1) * SUB_BUCKETS + ((v >> shift) & (SUB_BUCKETS - 1));
+}
+
+void htt_metrics_add(enum htt_metrics_counter counter, uint64_t n) {
+	add_relaxed(&get_local()->counters[counter], n);
+}
+
+void htt_metrics_count_status(int status) {
+	if (status < STATUS_MIN || status > STATUS_MAX) return;
+	add_relaxed(&get_local()->status[status - STATUS_MIN], 1);
+}
+
+void htt_metrics_observe(enum htt_metrics_stage stage, uint64_t ns) {
+	struct stage_histogram *h = &get_local()->stages[stage];
+	add_relaxed(&h->buckets[bucket_index(ns)], 1);
+	add_relaxed(&h->sum_ns, ns);
+}
+
+static const char *COUNTER_NAMES[HTT_METRIC_COUNTER_COUNT] = {
+	[HTT_METRIC_ACCEPTS] = "htt_accepts_total",
+	[HTT_METRIC_CLOSES] = "htt_closes_total",
+	[HTT_METRIC_BYTES_SENT] = "htt_bytes_sent_total",
+	[HTT_METRIC_CACHE_HITS] = "htt_file_cache_hits_total",
+	[HTT_METRIC_CACHE_MISSES] = "htt_file_cache_misses_total",
+	[HTT_METRIC_PATH_CACHE_HITS] = "htt_path_cache_hits_total",
+	[HTT_METRIC_PATH_CACHE_MISSES] = "htt_path_cache_misses_total"
+};
+
+static const char *COUNTER_HELP[HTT_METRIC_COUNTER_COUNT] = {
+	[HTT_METRIC_ACCEPTS] = "Connections accepted.",
+	[HTT_METRIC_CLOSES] = "Connections closed.",
+	[HTT_METRIC_BYTES_SENT] = "Response bytes sent, including headers.",
+	[HTT_METRIC_CACHE_HITS] = "Files served from the in-memory cache.",
+	[HTT_METRIC_CACHE_MISSES] = "Cacheable files that had to be read from disk.",
+	[HTT_METRIC_PATH_CACHE_HITS] = "Request paths that didn't have to be resolved again.",
+	[HTT_METRIC_PATH_CACHE_MISSES] = "Request paths that had to be resolved on disk."
+};
+
+static const char *STAGE_NAMES[HTT_STAGE_COUNT] = {
+	[HTT_STAGE_HEADER_RECV] = "header_recv",
+	[HTT_STAGE_PARSE_REQUEST] = "parse_request",
+	[HTT_STAGE_PARSE_URI] = "parse_uri",
+	[HTT_STAGE_CREATE_RESPONSE] = "create_response",
+	[HTT_STAGE_BODY_SEND] = "body_send"
+};
+
+void htt_metrics_render(FILE *fp) {
+	static struct loop_metrics total;
+	static pthread_mutex_t total_lock = PTHREAD_MUTEX_INITIALIZER;
+
+	// the totals are too big for the stack, so different loops take turns with them
+	pthread_mutex_lock(&total_lock);
+	memset(&total, 0, sizeof(total));
+	for (struct loop_metrics *m = __atomic_load_n(&registry, __ATOMIC_ACQUIRE); m; m = m->next) {
+		for (int i = 0; i < HTT_METRIC_COUNTER_COUNT; ++i) total.counters[i] += load_relaxed(&m->counters[i]);
+		for (int i = 0; i <= STATUS_MAX - STATUS_MIN; ++i) total.status[i] += load_relaxed(&m->status[i]);
+		for (int s = 0; s < HTT_STAGE_COUNT; ++s) {
+			total.stages[s].sum_ns += load_relaxed(&m->stages[s].sum_ns);
+			for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) total.stages[s].buckets[i] += load_relaxed(&m->stages[s].buckets[i]);
+		}
+	}
+
+	for (int i = 0; i < HTT_METRIC_COUNTER_COUNT; ++i) {
+		fprintf(fp, "# HELP %1$s %2$s\n# TYPE %1$s counter\n%1$s %3$lu\n",
+			COUNTER_NAMES[i], COUNTER_HELP[i], (unsigned long) total.counters[i]);
+	}
+
+	fprintf(fp, "# HELP htt_active_connections Connections currently open.\n"
+		"# TYPE htt_active_connections gauge\nhtt_active_connections %lu\n",
+		(unsigned long) (total.counters[HTT_METRIC_ACCEPTS] - total.counters[HTT_METRIC_CLOSES]));
+
+	fprintf(fp, "# HELP htt_responses_total Responses by status.\n# TYPE htt_responses_total counter\n");
+	for (int i = 0; i <= STATUS_MAX - STATUS_MIN; ++i) {
+		if (!total.status[i]) continue;
+		fprintf(fp, "htt_responses_total{code=\"%d\",reason=\"%s\"} %lu\n",
+			i + STATUS_MIN, http_status_str(i + STATUS_MIN), (unsigned long) total.status[i]);
+	}
+
+	fprintf(fp, "# HELP htt_stage_duration_seconds Time spent in each stage of handling a request.\n"
+		"# TYPE htt_stage_duration_seconds histogram\n");
+	for (int s = 0; s < HTT_STAGE_COUNT; ++s) {
+		const struct stage_histogram *h = &total.stages[s];
+		uint64_t cumulative = 0;
+		unsigned next = 0;
+		// every bucket below 2^exp holds only values below it, since the splits line up
+		for (int exp = EXPORT_MIN_EXP; exp <= EXPORT_MAX_EXP; ++exp) {
+			unsigned limit = bucket_index((uint64_t) 1 << exp);
+			for (; next < limit; ++next) cumulative += h->buckets[next];
+			fprintf(fp, "htt_stage_duration_seconds_bucket{stage=\"%s\",le=\"%.9g\"} %lu\n",
+				STAGE_NAMES[s], (double) ((uint64_t) 1 << exp) / 1e9, (unsigned long) cumulative);
+		}
+		// the count comes from the buckets too, so it always agrees with them
+		for (; next < HISTOGRAM_BUCKETS; ++next) cumulative += h->buckets[next];
+		fprintf(fp, "htt_stage_duration_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %lu\n", STAGE_NAMES[s], (unsigned long) cumulative);
+		fprintf(fp, "htt_stage_duration_seconds_sum{stage=\"%s\"} %.9f\n", STAGE_NAMES[s], h->sum_ns / 1e9);
+		fprintf(fp, "htt_stage_duration_seconds_count{stage=\"%s\"} %lu\n", STAGE_NAMES[s], (unsigned long) cumulative);
+	}
+
+	pthread_mutex_unlock(&total_lock);
+}
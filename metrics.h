@@ -0,0 +1,87 @@
+/**
+ * @file metrics.h
+ * @author Will Brown
+ * @brief Counters and latency histograms kept by every event loop
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026 Will Brown
+ */
+
+#ifndef HTT_METRICS_H
+#define HTT_METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @brief Counters that only ever go up
+ */
+enum htt_metrics_counter {
+    HTT_METRIC_ACCEPTS, ///< Connections accepted
+    HTT_METRIC_CLOSES, ///< Connections closed
+    HTT_METRIC_BYTES_SENT, ///< Response bytes sent, including headers
+    HTT_METRIC_CACHE_HITS, ///< Files served from the file cache
+    HTT_METRIC_CACHE_MISSES, ///< Cacheable files that had to be read from disk
+    HTT_METRIC_PATH_CACHE_HITS, ///< Request paths that didn't have to be resolved again
+    HTT_METRIC_PATH_CACHE_MISSES, ///< Request paths that had to be resolved on disk
+    HTT_METRIC_COUNTER_COUNT
+};
+
+/**
+ * @brief Stages of handling a request that are timed
+ */
+enum htt_metrics_stage {
+    HTT_STAGE_HEADER_RECV, ///< First byte of the request to the end of its header
+    HTT_STAGE_PARSE_REQUEST, ///< parse_http_request
+    HTT_STAGE_PARSE_URI, ///< parse_uri
+    HTT_STAGE_CREATE_RESPONSE, ///< create_response, including parse_uri
+    HTT_STAGE_BODY_SEND, ///< Response created to last byte sent
+    HTT_STAGE_COUNT
+};
+
+/**
+ * @brief Get the monotonic clock in nanoseconds, for timing stages
+ *
+ * @return the time
+ */
+static inline uint64_t htt_metrics_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief Add to one of the calling event loop's counters
+ *
+ * @param counter counter to add to
+ * @param n amount to add
+ */
+void htt_metrics_add(enum htt_metrics_counter counter, uint64_t n);
+
+/**
+ * @brief Count a response by its status code
+ *
+ * @param status HTTP status of the response
+ */
+void htt_metrics_count_status(int status);
+
+/**
+ * @brief Record how long a stage took on the calling event loop
+ *
+ * @param stage stage that was timed
+ * @param ns duration in nanoseconds
+ */
+void htt_metrics_observe(enum htt_metrics_stage stage, uint64_t ns);
+
+/**
+ * @brief Write the metrics of every event loop, added together, in Prometheus text format
+ * @details Each event loop only ever writes its own metrics, so recording them needs no
+ * locks or atomic read-modify-write instructions. Totals are only worked out when they are read.
+ *
+ * @param fp stream to write to
+ */
+void htt_metrics_render(FILE *fp);
+
+#endif // HTT_METRICS_H
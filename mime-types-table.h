@@ -0,0 +1,236 @@
+// Generated from mime-types.txt by tools/gen-mime-types, do not edit.
+
+static const uint32_t BUILTIN_MIME_DISPLACEMENTS[108] = {
+	27, 0, 0, 14, 0, 0, 0, 0, 0, 0, 793, 71, 176, 16, 0, 0,
+	0, 0, 203, 0, 0, 331, 0, 0, 3, 210, 165, 0, 0, 1101, 0, 0,
+	28, 0, 121, 0, 87, 0, 0, 67, 0, 0, 33, 0, 41, 0, 0, 9,
+	0, 0, 78, 0, 89, 0, 561, 157, 5, 17, 279, 3, 0, 0, 0, 0,
+	132, 0, 82, 56, 96, 0, 0, 0, 41, 59, 0, 0, 0, 0, 62, 0,
+	334, 0, 402, 115, 0, 953, 0, 38, 0, 66, 0, 0, 335, 173, 0, 0,
+	0, 917, 0, 0, 0, 0, 0, 10, 191, 0, 148, 0,
+};
+
+static const struct htt_phash_entry BUILTIN_MIME_ENTRIES[214] = {
+	{ "csv", "text/csv" },
+	{ "yaml", "text/yaml" },
+	{ "azw", "application/vnd.amazon.ebook" },
+	{ "jnlp", "application/x-java-jnlp-file" },
+	{ "xltm", "application/vnd.ms-excel.template.macroenabled.12" },
+	{ "war", "application/java-archive" },
+	{ "wps", "application/x-msworks" },
+	{ "kar", "audio/midi" },
+	{ "flv", "video/x-flv" },
+	{ "ps", "application/postscript" },
+	{ "chm", "application/vnd.ms-htmlhelp" },
+	{ "potx", "application/vnd.openxmlformats-officedocument.presentationml.template" },
+	{ "pdb", "application/x-pilot" },
+	{ "pptx", "application/vnd.openxmlformats-officedocument.presentationml.presentation" },
+	{ "webp", "image/webp" },
+	{ "hqx", "application/mac-binhex40" },
+	{ "sh", "application/x-sh" },
+	{ "m4v", "video/x-m4v" },
+	{ "xspf", "application/xspf+xml" },
+	{ "docx", "application/vnd.openxmlformats-officedocument.wordprocessingml.document" },
+	{ "mpeg", "video/mpeg" },
+	{ "pcl", "application/vnd.hp-pcl" },
+	{ "img", "application/octet-stream" },
+	{ "obd", "application/x-ms-binder" },
+	{ "otg", "application/vnd.oasis.opendocument.graphics-template" },
+	{ "ics", "text/calendar" },
+	{ "cda", "application/x-cdf" },
+	{ "rss", "application/rss+xml" },
+	{ "trm", "application/x-msterminal" },
+	{ "css", "text/css" },
+	{ "tcl", "application/x-tcl" },
+	{ "ram", "audio/x-pn-realaudio" },
+	{ "otf", "font/otf" },
+	{ "json", "application/json" },
+	{ "bmp", "image/bmp" },
+	{ "mml", "text/mathml" },
+	{ "rtf", "application/rtf" },
+	{ "mvb", "application/x-msmediaview" },
+	{ "odt", "application/vnd.oasis.opendocument.text" },
+	{ "rpm", "application/x-redhat-package-manager" },
+	{ "dotm", "application/vnd.ms-word.template.macroenabled.12" },
+	{ "tar", "application/x-tar" },
+	{ "ts", "video/mp2t" },
+	{ "m3u8", "application/vnd.apple.mpegurl" },
+	{ "ttf", "font/ttf" },
+	{ "m4a", "audio/x-m4a" },
+	{ "wasm", "application/wasm" },
+	{ "js", "application/javascript" },
+	{ "xlsb", "application/vnd.ms-excel.sheet.binary.macroenabled.12" },
+	{ "kml", "application/vnd.google-earth.kml+xml" },
+	{ "wma", "audio/x-ms-wma" },
+	{ "run", "application/x-makeself" },
+	{ "m3u", "audio/x-mpegurl" },
+	{ "tfm", "application/x-tex-tfm" },
+	{ "odi", "application/vnd.oasis.opendocument.image" },
+	{ "txt", "text/plain" },
+	{ "crd", "application/x-mscardfile" },
+	{ "bin", "application/octet-stream" },
+	{ "pdf", "application/pdf" },
+	{ "sit", "application/x-stuffit" },
+	{ "rar", "application/x-rar-compressed" },
+	{ "wvx", "video/x-ms-wvx" },
+	{ "xltx", "application/vnd.openxmlformats-officedocument.spreadsheetml.template" },
+	{ "der", "application/x-x509-ca-cert" },
+	{ "ots", "application/vnd.oasis.opendocument.spreadsheet-template" },
+	{ "hlp", "application/winhlp" },
+	{ "ico", "image/x-icon" },
+	{ "oti", "application/vnd.oasis.opendocument.image-template" },
+	{ "midi", "audio/midi" },
+	{ "hpgl", "application/vnd.hp-hpgl" },
+	{ "c", "text/x-c" },
+	{ "woff", "font/woff" },
+	{ "wbmp", "image/vnd.wap.wbmp" },
+	{ "sea", "application/x-sea" },
+	{ "webm", "video/webm" },
+	{ "arc", "application/x-freearc" },
+	{ "pem", "application/x-x509-ca-cert" },
+	{ "ra", "audio/x-realaudio" },
+	{ "cco", "application/x-cocoa" },
+	{ "ods", "application/vnd.oasis.opendocument.spreadsheet" },
+	{ "pnm", "image/x-portable-anymap" },
+	{ "3gpp", "video/3gpp" },
+	{ "msp", "application/octet-stream" },
+	{ "odf", "application/vnd.oasis.opendocument.formula" },
+	{ "odp", "application/vnd.oasis.opendocument.presentation" },
+	{ "msi", "application/octet-stream" },
+	{ "otp", "application/vnd.oasis.opendocument.presentation-template" },
+	{ "pbm", "image/x-portable-bitmap" },
+	{ "php", "application/x-httpd-php" },
+	{ "odg", "application/vnd.oasis.opendocument.graphics" },
+	{ "xml", "application/xml" },
+	{ "wmv", "video/x-ms-wmv" },
+	{ "html", "text/html" },
+	{ "atom", "application/atom+xml" },
+	{ "tiff", "image/tiff" },
+	{ "xap", "application/x-silverlight-app" },
+	{ "gif", "image/gif" },
+	{ "png", "image/png" },
+	{ "sldx", "application/vnd.openxmlformats-officedocument.presentationml.slide" },
+	{ "vsdx", "application/vnd.visio2013" },
+	{ "htc", "text/x-component" },
+	{ "pgp", "application/pgp-encrypted" },
+	{ "cab", "application/vnd.ms-cab-compressed" },
+	{ "xps", "application/vnd.ms-xpsdocument" },
+	{ "ogx", "application/ogg" },
+	{ "prc", "application/x-pilot" },
+	{ "xlsx", "application/vnd.openxmlformats-officedocument.spreadsheetml.sheet" },
+	{ "bz2", "application/x-bzip2" },
+	{ "wml", "text/vnd.wap.wml" },
+	{ "xbap", "application/x-ms-xbap" },
+	{ "wmlc", "application/vnd.wap.wmlc" },
+	{ "ogv", "video/ogg" },
+	{ "ppsx", "application/vnd.openxmlformats-officedocument.presentationml.slideshow" },
+	{ "bz", "application/x-bzip" },
+	{ "pic", "application/x-pict" },
+	{ "avi", "video/msvideo" },
+	{ "ott", "application/vnd.oasis.opendocument.text-template" },
+	{ "tk", "application/x-tcl" },
+	{ "7z", "application/x-7z-compressed" },
+	{ "wri", "application/x-mswrite" },
+	{ "opus", "audio/opus" },
+	{ "mid", "audio/midi" },
+	{ "xlsm", "application/vnd.ms-excel.sheet.macroenabled.12" },
+	{ "dtshd", "audio/vnd.dts.hd" },
+	{ "mdb", "application/x-msaccess" },
+	{ "jpeg", "image/jpeg" },
+	{ "otc", "application/vnd.oasis.opendocument.chart-template" },
+	{ "avif", "image/avif" },
+	{ "xpi", "application/x-xpinstall" },
+	{ "zip", "application/zip" },
+	{ "pm", "application/x-perl" },
+	{ "shtml", "text/html" },
+	{ "s", "text/x-asm" },
+	{ "latex", "application/x-latex" },
+	{ "svgz", "image/svg+xml" },
+	{ "gz", "application/gzip" },
+	{ "jardiff", "application/x-java-archive-diff" },
+	{ "kmz", "application/vnd.google-earth.kmz" },
+	{ "wmx", "video/x-ms-wmx" },
+	{ "sig", "application/pgp-signature" },
+	{ "rmp", "audio/x-pn-realaudio-plugin" },
+	{ "mny", "application/x-msmoney" },
+	{ "ppt", "application/vnd.ms-powerpoint" },
+	{ "jpg", "image/jpeg" },
+	{ "deb", "application/x-debian-package" },
+	{ "svg", "image/svg+xml" },
+	{ "rm", "application/vnd.rn-realmedia" },
+	{ "docm", "application/vnd.ms-word.document.macroenabled.12" },
+	{ "jad", "text/vnd.sun.j2me.app-descriptor" },
+	{ "xls", "application/vnd.ms-excel" },
+	{ "asx", "video/x-ms-asf" },
+	{ "epub", "application/epub+zip" },
+	{ "vsd", "application/vnd.visio" },
+	{ "mp4", "video/mp4" },
+	{ "msm", "application/octet-stream" },
+	{ "wax", "audio/x-ms-wax" },
+	{ "xul", "application/vnd.mozilla.xul+xml" },
+	{ "dts", "audio/vnd.dts" },
+	{ "oga", "audio/ogg" },
+	{ "abw", "application/x-abiword" },
+	{ "wmd", "application/x-ms-wmd" },
+	{ "wav", "audio/wav" },
+	{ "eps", "application/postscript" },
+	{ "htm", "text/html" },
+	{ "mng", "video/x-mng" },
+	{ "doc", "application/msword" },
+	{ "woff2", "font/woff2" },
+	{ "crt", "application/x-x509-ca-cert" },
+	{ "jsonld", "application/ld+json" },
+	{ "xhtml", "application/xhtml+xml" },
+	{ "ppm", "image/x-portable-pixmap" },
+	{ "ai", "application/postscript" },
+	{ "wmz", "application/x-ms-wmz" },
+	{ "mpg", "video/mpeg" },
+	{ "mp3", "audio/mpeg" },
+	{ "123", "application/vnd.lotus-1-2-3" },
+	{ "tex", "application/x-tex" },
+	{ "jng", "image/x-jng" },
+	{ "aac", "audio/aac" },
+	{ "ear", "application/java-archive" },
+	{ "exe", "application/x-msdownload" },
+	{ "pub", "application/x-mspublisher" },
+	{ "wm", "video/x-ms-wm" },
+	{ "asf", "video/x-ms-asf" },
+	{ "mov", "video/quicktime" },
+	{ "dmg", "application/x-apple-diskimage" },
+	{ "tif", "image/tiff" },
+	{ "wpl", "vnd.ms-wpl" },
+	{ "mjs", "application/javascript" },
+	{ "eot", "application/vnd.ms-fontobject" },
+	{ "odft", "application/vnd.oasis.opendocument.formula-template" },
+	{ "3g2", "video/3gpp2" },
+	{ "ogg", "audio/ogg" },
+	{ "xlp", "application/x-msclip" },
+	{ "dll", "application/octet-stream" },
+	{ "wmf", "application/x-msmetafile" },
+	{ "swf", "application/x-shockwave-flash" },
+	{ "dotx", "application/vnd.openxmlformats-officedocument.wordprocessingml.template" },
+	{ "odm", "application/vnd.oasis.opendocument.text-master" },
+	{ "pgm", "image/x-portable-graymap" },
+	{ "pcx", "image/x-pcx" },
+	{ "sitx", "application/x-stuffitx" },
+	{ "iso", "application/octet-stream" },
+	{ "csh", "application/x-csh" },
+	{ "xlam", "application/vnd.ms-excel.addin.macroenabled.12" },
+	{ "odc", "application/vnd.oasis.opendocument.chart" },
+	{ "onetoc", "application/onenote" },
+	{ "asc", "application/pgp-signature" },
+	{ "pfa", "application/x-font-type1" },
+	{ "jar", "application/java-archive" },
+	{ "pl", "application/x-perl" },
+	{ "3gp", "video/3gpp" },
+	{ "weba", "audio/webm" },
+	{ "wad", "application/x-doom" },
+};
+
+static const struct htt_phash BUILTIN_MIME_TYPES = {
+	.seed = 0x0000000000000000ULL,
+	.bucket_count = 108,
+	.size = 214,
+	.displacements = BUILTIN_MIME_DISPLACEMENTS,
+	.entries = BUILTIN_MIME_ENTRIES
+};
@@ -4,25 +4,52 @@
 #include <errno.h>
 
 #include "config.h"
-#include "trie.h"
+#include "perfect-hash.h"
 
-static struct htt_trie *mime_type_trie;
+#include "mime-types-table.h"
 
+static struct htt_phash loaded_mime_types;
+static const struct htt_phash *mime_types = &BUILTIN_MIME_TYPES;
+
+// only needed when the built-in list is overridden, since that one is generated at build time
 void load_mime_type_list(void) {
-	mime_type_trie = htt_trie_create();
+	if (!global_config.mime_type_path) return;
 	FILE *fp = fopen(global_config.mime_type_path, "r");
 	if (!fp) {
 		fprintf(stderr, "Failed to open MIME type list: %s\n", strerror(errno));
 		exit(1);
 	}
 	
+	struct htt_phash_entry *entries = NULL;
+	size_t count = 0, cap = 0;
 	char *key, *value;
 	while (fscanf(fp, "%m[^=]=%ms\n", &key, &value) == 2) {
-		htt_trie_insert(mime_type_trie, key, value);
-		free(key);
+		if (count == cap) {
+			cap = cap ? cap * 2 : 256;
+			entries = realloc(entries, cap * sizeof(*entries));
+			if (!entries) {
+				fprintf(stderr, "Failed to load MIME type list: out of memory\n");
+				exit(1);
+			}
+		}
+		for (char *c = key; *c; ++c) *c = htt_phash_lower(*c);
+		entries[count++] = (struct htt_phash_entry) { key, value };
 	}
-	
 	fclose(fp);
+	
+	// the table points at the strings, so only the list itself is freed
+	if (htt_phash_build(&loaded_mime_types, entries, count)) {
+		fprintf(stderr, "Failed to build MIME type table\n");
+		exit(1);
+	}
+	// except for extensions listed more than once, where only the last entry made it into the table
+	for (size_t i = 0; i < count; ++i) {
+		if (htt_phash_search(&loaded_mime_types, entries[i].key) == entries[i].value) continue;
+		free((char *) entries[i].key);
+		free((char *) entries[i].value);
+	}
+	free(entries);
+	mime_types = &loaded_mime_types;
 }
 
 // Returns the extension of a file (if there is one)
@@ -36,5 +63,26 @@ const char *get_file_ext(const char *path) {
 // Looks up the mime type associated with a file extension
 // Returns the mime type on success, or NULL if it is unknown.
 const char *lookup_mime_type(const char *ext) {
-	return htt_trie_search(mime_type_trie, ext);
+	return htt_phash_search(mime_types, ext);
+}
+
+static int ends_with(const char *s, const char *suffix) {
+	size_t len = strlen(s), suffix_len = strlen(suffix);
+	return len >= suffix_len && !strcmp(s + len - suffix_len, suffix);
+}
+
+int mime_type_compressible(const char *mime_type) {
+	if (!mime_type) return 0;
+	if (!strncmp(mime_type, "text/", 5)) return 1;
+	if (ends_with(mime_type, "+xml") || ends_with(mime_type, "+json")) return 1;
+	
+	static const char *COMPRESSIBLE[] = {
+		"application/javascript", "application/x-javascript", "application/json",
+		"application/xml", "application/wasm",
+		"application/x-sh", "image/x-icon", "image/vnd.microsoft.icon", "font/ttf", "font/otf"
+	};
+	for (size_t i = 0; i < sizeof(COMPRESSIBLE) / sizeof(COMPRESSIBLE[0]); ++i) {
+		if (!strcmp(mime_type, COMPRESSIBLE[i])) return 1;
+	}
+	return 0;
 }
@@ -11,6 +11,10 @@
 #ifndef MIME_TYPES_H
 #define MIME_TYPES_H
 
+/**
+ * @brief Replace the built-in MIME types with the list at mime_type_path, if one is set
+ * @details Exits if the list can't be loaded.
+ */
 void load_mime_type_list(void);
 
 /**
@@ -29,4 +33,13 @@ const char *get_file_ext(const char *path);
  */
 const char *lookup_mime_type(const char *ext);
 
+/**
+ * @brief Check whether content of a mime type is worth compressing
+ * @details Text and text-like formats compress well, while most other formats are already compressed.
+ * 
+ * @param mime_type the mime type to check, may be NULL
+ * @return 1 if it should be compressed, 0 if not
+ */
+int mime_type_compressible(const char *mime_type);
+
 #endif
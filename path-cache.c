@@ -0,0 +1,79 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/stat.h>
+
+#include "config.h"
+#include "path-cache.h"
+
+// one table per event loop, so nothing here needs locking
+struct path_cache {
+	struct path_cache_entry *slots;
+	size_t slot_count; ///< always a power of two
+};
+
+static _Thread_local struct path_cache cache;
+
+// FNV-1a
+static size_t hash_key(const char *key) {
+	size_t h = 14695981039346656037ULL;
+	for (; *key; ++key) {
+		h ^= (unsigned char) *key;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+static void clear_entry(struct path_cache_entry *entry) {
+	free(entry->key);
+	free(entry->path);
+	entry->key = NULL;
+	entry->path = NULL;
+}
+
+// each key has exactly one slot, so the table never grows past its configured size
+static struct path_cache_entry *slot_for(const char *key) {
+	if (!cache.slots) {
+		if (!global_config.path_cache_size) return NULL;
+		size_t count = 1;
+		while (count < global_config.path_cache_size) count <<= 1;
+		cache.slots = calloc(count, sizeof(*cache.slots));
+		if (!cache.slots) return NULL;
+		cache.slot_count = count;
+	}
+	return &cache.slots[hash_key(key) & (cache.slot_count - 1)];
+}
+
+const struct path_cache_entry *path_cache_lookup(const char *key) {
+	struct path_cache_entry *entry = slot_for(key);
+	if (!entry || !entry->key || strcmp(entry->key, key)) return NULL;
+
+	if (time(NULL) >= entry->expires) {
+		clear_entry(entry);
+		return NULL;
+	}
+	return entry;
+}
+
+void path_cache_insert(const char *key, const char *path, const struct stat *filestat, int status) {
+	struct path_cache_entry *entry = slot_for(key);
+	if (!entry) return;
+
+	clear_entry(entry);
+	entry->key = strdup(key);
+	entry->path = path ? strdup(path) : NULL;
+	if (!entry->key || (path && !entry->path)) {
+		clear_entry(entry);
+		return;
+	}
+	entry->filestat = *filestat;
+	entry->status = status;
+	entry->expires = time(NULL) + global_config.path_cache_ttl;
+}
+
+void path_cache_invalidate(const char *key) {
+	if (!cache.slots) return;
+	struct path_cache_entry *entry = slot_for(key);
+	if (entry->key && !strcmp(entry->key, key)) clear_entry(entry);
+}
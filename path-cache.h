@@ -0,0 +1,58 @@
+/**
+ * @file path-cache.h
+ * @author Will Brown
+ * @brief Cache of request paths that have already been resolved on disk
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026 Will Brown
+ */
+
+#ifndef PATH_CACHE_H
+#define PATH_CACHE_H
+
+#include <time.h>
+
+#include <sys/stat.h>
+
+/**
+ * @brief A resolved request path
+ * @details Failures are cached too, so repeated requests for missing files don't walk the disk.
+ */
+struct path_cache_entry {
+    char *key; ///< Request path as it was sent, without the leading '/' or the query
+    char *path; ///< Resolved path or redirect target, as found in struct URI, NULL if there is none
+    struct stat filestat; ///< File status when the path was resolved
+    int status; ///< URI_status or HTTP status code the path resolved to
+    time_t expires; ///< Time the entry stops being used
+};
+
+/**
+ * @brief Look up a request path
+ * @details Entries are only trusted for path_cache_ttl seconds, since changes to the
+ * document root aren't watched for.
+ *
+ * @param key request path without the leading '/' or the query
+ * @return the entry, valid until the next call to path_cache_insert, or NULL on a miss
+ */
+const struct path_cache_entry *path_cache_lookup(const char *key);
+
+/**
+ * @brief Remember what a request path resolved to, replacing whatever shared its slot
+ *
+ * @param key request path without the leading '/' or the query
+ * @param path resolved path or redirect target, may be NULL
+ * @param filestat status of the file
+ * @param status URI_status or HTTP status code
+ */
+void path_cache_insert(const char *key, const char *path, const struct stat *filestat, int status);
+
+/**
+ * @brief Forget a request path, so the next lookup resolves it again
+ * @details Used when a cached path turns out to be wrong before its entry expires.
+ *
+ * @param key request path without the leading '/' or the query
+ */
+void path_cache_invalidate(const char *key);
+
+#endif // PATH_CACHE_H
@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "perfect-hash.h"
+
+// seeds tried before giving up, each one almost always works
+#define MAX_SEEDS 64
+
+struct build_key {
+	struct htt_phash_entry entry;
+	size_t index; ///< Position in the caller's list, so later duplicates win
+	uint64_t hash;
+	uint32_t bucket;
+};
+
+static int compare_keys(const void *a, const void *b) {
+	const struct build_key *x = a, *y = b;
+	int cmp = strcmp(x->entry.key, y->entry.key);
+	if (cmp) return cmp;
+	return (x->index > y->index) - (x->index < y->index);
+}
+
+// bucket sizes for the current seed, read by compare_buckets
+static uint32_t *sort_bucket_sizes;
+
+// biggest buckets go first, while there's still plenty of room to place them
+static int compare_buckets(const void *a, const void *b) {
+	const struct build_key *x = a, *y = b;
+	uint32_t x_size = sort_bucket_sizes[x->bucket], y_size = sort_bucket_sizes[y->bucket];
+	if (x_size != y_size) return x_size < y_size ? 1 : -1;
+	return (x->bucket > y->bucket) - (x->bucket < y->bucket);
+}
+
+// find a displacement that puts every key of a bucket into a free slot
+static int place_bucket(struct htt_phash *t, struct build_key *keys, size_t count, char *taken) {
+	uint64_t max_tries = 16 * (uint64_t) t->size + 1024;
+	for (uint64_t d = 0; d < max_tries && d <= UINT32_MAX; ++d) {
+		size_t placed = 0;
+		for (; placed < count; ++placed) {
+			uint32_t slot = htt_phash_slot(t, keys[placed].hash, d);
+			if (taken[slot]) break;
+			taken[slot] = 1;
+		}
+		if (placed == count) {
+			((uint32_t *) t->displacements)[keys[0].bucket] = d;
+			return 1;
+		}
+		while (placed--) taken[htt_phash_slot(t, keys[placed].hash, d)] = 0;
+	}
+	return 0;
+}
+
+static int try_seed(struct htt_phash *t, struct build_key *keys, uint32_t *bucket_sizes, char *taken) {
+	memset(bucket_sizes, 0, t->bucket_count * sizeof(*bucket_sizes));
+	memset((uint32_t *) t->displacements, 0, t->bucket_count * sizeof(*t->displacements));
+	memset(taken, 0, t->size);
+
+	for (size_t i = 0; i < t->size; ++i) {
+		keys[i].hash = htt_phash_hash(t->seed, keys[i].entry.key);
+		keys[i].bucket = htt_phash_bucket(t, keys[i].hash);
+		++bucket_sizes[keys[i].bucket];
+	}
+	sort_bucket_sizes = bucket_sizes;
+	qsort(keys, t->size, sizeof(*keys), &compare_buckets);
+
+	for (size_t i = 0; i < t->size;) {
+		size_t count = bucket_sizes[keys[i].bucket];
+		if (!place_bucket(t, keys + i, count, taken)) return 0;
+		i += count;
+	}
+
+	struct htt_phash_entry *entries = (struct htt_phash_entry *) t->entries;
+	for (size_t i = 0; i < t->size; ++i) {
+		entries[htt_phash_slot(t, keys[i].hash, t->displacements[keys[i].bucket])] = keys[i].entry;
+	}
+	return 1;
+}
+
+int htt_phash_build(struct htt_phash *t, const struct htt_phash_entry *entries, size_t count) {
+	*t = (struct htt_phash) {0};
+	if (!count) return 0;
+
+	struct build_key *keys = malloc(count * sizeof(*keys));
+	if (!keys) return -1;
+	for (size_t i = 0; i < count; ++i) keys[i] = (struct build_key) { .entry = entries[i], .index = i };
+
+	// drop all but the last entry for each key
+	qsort(keys, count, sizeof(*keys), &compare_keys);
+	size_t unique = 0;
+	for (size_t i = 0; i < count; ++i) {
+		if (i + 1 < count && !strcmp(keys[i].entry.key, keys[i + 1].entry.key)) continue;
+		keys[unique++] = keys[i];
+	}
+
+	// two keys per bucket on average keeps the displacement array small without
+	// making buckets hard to place
+	t->size = unique;
+	t->bucket_count = unique / 2 + 1;
+	t->displacements = malloc(t->bucket_count * sizeof(*t->displacements));
+	t->entries = malloc(t->size * sizeof(*t->entries));
+	uint32_t *bucket_sizes = malloc(t->bucket_count * sizeof(*bucket_sizes));
+	char *taken = malloc(t->size);
+
+	int placed = 0;
+	if (t->displacements && t->entries && bucket_sizes && taken) {
+		for (uint64_t attempt = 0; attempt < MAX_SEEDS && !placed; ++attempt) {
+			t->seed = attempt * 0x9e3779b97f4a7c15ULL;
+			placed = try_seed(t, keys, bucket_sizes, taken);
+		}
+	}
+
+	free(keys);
+	free(bucket_sizes);
+	free(taken);
+	if (!placed) {
+		htt_phash_destroy(t);
+		return -1;
+	}
+	return 0;
+}
+
+void htt_phash_destroy(struct htt_phash *t) {
+	free((uint32_t *) t->displacements);
+	free((struct htt_phash_entry *) t->entries);
+	*t = (struct htt_phash) {0};
+}
@@ -0,0 +1,110 @@
+/**
+ * @file perfect-hash.h
+ * @author Will Brown
+ * @brief Minimal perfect hash tables for fixed sets of string keys
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026 Will Brown
+ */
+
+#ifndef HTT_PHASH_H
+#define HTT_PHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief A key and the value it maps to
+ */
+struct htt_phash_entry {
+    const char *key;
+    const char *value;
+};
+
+/**
+ * @brief A read-only table with exactly one slot per key
+ * @details Keys are hashed once. The hash picks a bucket, and the bucket's displacement
+ * is mixed into the same hash to pick the slot, so a lookup is one hash, two array reads
+ * and one compare. Keys are ASCII and case insensitive.
+ *
+ * Tables are either built at runtime with htt_phash_build, or generated ahead of time
+ * by tools/gen-mime-types and compiled in as static arrays.
+ */
+struct htt_phash {
+    uint64_t seed; ///< Seed the keys are hashed with, chosen so every bucket could be placed
+    uint32_t bucket_count;
+    uint32_t size; ///< Number of keys, and of slots
+    const uint32_t *displacements; ///< One per bucket
+    const struct htt_phash_entry *entries; ///< One per slot
+};
+
+static inline unsigned char htt_phash_lower(unsigned char c) {
+	return c >= 'A' && c <= 'Z' ? c | 0x20 : c;
+}
+
+// FNV-1a with the case bit forced on, so keys that differ only in case hash the same.
+// Some other characters collide too ('_' and DEL), which costs nothing, since the key is compared anyway.
+static inline uint64_t htt_phash_hash(uint64_t seed, const char *key) {
+	uint64_t h = 14695981039346656037ULL ^ seed;
+	for (; *key; ++key) {
+		h ^= (unsigned char) *key | 0x20;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+// the high half of the hash picks the bucket and the low half the slot, both by
+// multiplying into range instead of dividing
+static inline uint32_t htt_phash_bucket(const struct htt_phash *t, uint64_t h) {
+	return (uint32_t) (((h >> 32) * t->bucket_count) >> 32);
+}
+
+static inline uint32_t htt_phash_slot(const struct htt_phash *t, uint64_t h, uint32_t displacement) {
+	// the multiply carries differences in the low bits, like a different last character,
+	// up into the bits that pick the slot
+	uint32_t x = ((uint32_t) h ^ displacement) * 0x9e3779b9u;
+	return (uint32_t) (((uint64_t) x * t->size) >> 32);
+}
+
+/**
+ * @brief Look up a key
+ *
+ * @param t the table to search
+ * @param key the key to look up
+ * @return the value on success, or NULL if the key isn't in the table
+ */
+static inline const char *htt_phash_search(const struct htt_phash *t, const char *key) {
+	if (!t->size) return NULL;
+	uint64_t h = htt_phash_hash(t->seed, key);
+	const struct htt_phash_entry *entry = &t->entries[
+		htt_phash_slot(t, h, t->displacements[htt_phash_bucket(t, h)])
+	];
+	// stored keys are lowercase, so only the key being looked up needs folding
+	const char *stored = entry->key;
+	for (; *stored == htt_phash_lower(*key); ++stored, ++key) {
+		if (!*stored) return entry->value;
+	}
+	return NULL;
+}
+
+/**
+ * @brief Build a table from a list of entries
+ * @details Keys have to be lowercase. When a key appears more than once, the last entry
+ * wins. The strings aren't copied, so they have to outlive the table.
+ *
+ * @param t the table to fill in
+ * @param entries the entries, in any order
+ * @param count number of entries
+ * @return 0 on success, -1 if memory couldn't be allocated or the keys couldn't be placed
+ */
+int htt_phash_build(struct htt_phash *t, const struct htt_phash_entry *entries, size_t count);
+
+/**
+ * @brief Free the arrays of a table made by htt_phash_build
+ *
+ * @param t the table to free
+ */
+void htt_phash_destroy(struct htt_phash *t);
+
+#endif // HTT_PHASH_H
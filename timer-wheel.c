@@ -0,0 +1,112 @@
+#include <time.h>
+
+#include "timer-wheel.h"
+
+#define SLOT_MASK (HTT_TIMER_WHEEL_SLOTS - 1)
+
+// a coarse clock is plenty for one second ticks, and much cheaper to read
+static struct timespec now_monotonic(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return ts;
+}
+
+static void list_init(struct htt_timer *head) {
+	head->prev = head->next = head;
+}
+
+static void list_insert(struct htt_timer *head, struct htt_timer *timer) {
+	timer->prev = head->prev;
+	timer->next = head;
+	head->prev->next = timer;
+	head->prev = timer;
+}
+
+static void list_remove(struct htt_timer *timer) {
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->prev = timer->next = NULL;
+}
+
+// put a timer in the right slot for its expiry tick
+static void place(struct htt_timer_wheel *wheel, struct htt_timer *timer) {
+	uint64_t delta = timer->expires - wheel->now;
+	struct htt_timer *head;
+	if (delta < HTT_TIMER_WHEEL_SLOTS) {
+		head = &wheel->slots[0][timer->expires & SLOT_MASK];
+	} else {
+		head = &wheel->slots[1][(timer->expires >> HTT_TIMER_WHEEL_BITS) & SLOT_MASK];
+	}
+	list_insert(head, timer);
+}
+
+void htt_timer_wheel_init(struct htt_timer_wheel *wheel) {
+	wheel->now = now_monotonic().tv_sec;
+	wheel->count = 0;
+	for (int level = 0; level < HTT_TIMER_WHEEL_LEVELS; ++level) {
+		for (int slot = 0; slot < HTT_TIMER_WHEEL_SLOTS; ++slot) {
+			list_init(&wheel->slots[level][slot]);
+		}
+	}
+}
+
+void htt_timer_schedule(struct htt_timer_wheel *wheel, struct htt_timer *timer, unsigned seconds) {
+	htt_timer_cancel(wheel, timer);
+
+	// an empty wheel isn't advanced while the event loop sleeps, so catch up first
+	if (!wheel->count) wheel->now = now_monotonic().tv_sec;
+
+	// we are somewhere in the middle of the current tick, so round up to make sure at least
+	// the requested time passes. This also keeps timers out of the slot being processed.
+	if (seconds >= HTT_TIMER_MAX_TICKS) seconds = HTT_TIMER_MAX_TICKS - 1;
+
+	timer->expires = wheel->now + seconds + 1;
+	place(wheel, timer);
+	++wheel->count;
+}
+
+void htt_timer_cancel(struct htt_timer_wheel *wheel, struct htt_timer *timer) {
+	if (!timer->prev) return;
+	list_remove(timer);
+	--wheel->count;
+}
+
+void htt_timer_wheel_advance(struct htt_timer_wheel *wheel, htt_timer_expire_t expire) {
+	uint64_t target = now_monotonic().tv_sec;
+
+	while (wheel->now < target) {
+		++wheel->now;
+		if (!wheel->count) {
+			// nothing to expire, so skip straight to the present
+			wheel->now = target;
+			break;
+		}
+
+		// move timers from the second level down as they come within range
+		if (!(wheel->now & SLOT_MASK)) {
+			struct htt_timer *head = &wheel->slots[1][(wheel->now >> HTT_TIMER_WHEEL_BITS) & SLOT_MASK];
+			while (head->next != head) {
+				struct htt_timer *timer = head->next;
+				list_remove(timer);
+				place(wheel, timer);
+			}
+		}
+
+		struct htt_timer *head = &wheel->slots[0][wheel->now & SLOT_MASK];
+		while (head->next != head) {
+			struct htt_timer *timer = head->next;
+			list_remove(timer);
+			--wheel->count;
+			expire(timer);
+		}
+	}
+}
+
+int htt_timer_wheel_timeout(const struct htt_timer_wheel *wheel) {
+	if (!wheel->count) return -1;
+
+	// wake up at the start of the next tick
+	struct timespec ts = now_monotonic();
+	if ((uint64_t) ts.tv_sec > wheel->now) return 0;
+	return 1000 - ts.tv_nsec / 1000000;
+}
@@ -0,0 +1,92 @@
+/**
+ * @file timer-wheel.h
+ * @author Will Brown
+ * @brief Hierarchical timing wheel for connection timeouts
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026 Will Brown
+ */
+
+#ifndef HTT_TIMER_WHEEL_H
+#define HTT_TIMER_WHEEL_H
+
+#include <stdint.h>
+
+#define HTT_TIMER_WHEEL_BITS 6
+#define HTT_TIMER_WHEEL_SLOTS (1 << HTT_TIMER_WHEEL_BITS)
+#define HTT_TIMER_WHEEL_LEVELS 2
+
+/**
+ * @brief Longest timeout the wheel can hold in ticks, longer ones are clamped
+ */
+#define HTT_TIMER_MAX_TICKS ((1 << (HTT_TIMER_WHEEL_BITS * HTT_TIMER_WHEEL_LEVELS)) - 1)
+
+/**
+ * @brief A timer, meant to be embedded in whatever it times out
+ */
+struct htt_timer {
+    struct htt_timer *prev; ///< NULL if the timer isn't scheduled
+    struct htt_timer *next;
+    uint64_t expires; ///< Tick the timer expires on
+};
+
+/**
+ * @brief function pointer type for expired timers
+ */
+typedef void (*htt_timer_expire_t)(struct htt_timer *timer);
+
+/**
+ * @brief A timing wheel with one second ticks
+ * @details The first level holds timers expiring within the next 64 ticks, one slot per tick.
+ * The second level holds later timers, one slot per 64 ticks, and they are moved down into
+ * the first level as their time comes. Scheduling, cancelling and expiring are all O(1).
+ */
+struct htt_timer_wheel {
+    uint64_t now; ///< Current tick
+    unsigned count; ///< Number of scheduled timers
+    struct htt_timer slots[HTT_TIMER_WHEEL_LEVELS][HTT_TIMER_WHEEL_SLOTS]; ///< List heads
+};
+
+/**
+ * @brief Initialize a timing wheel, starting at the current time
+ *
+ * @param wheel the wheel to initialize
+ */
+void htt_timer_wheel_init(struct htt_timer_wheel *wheel);
+
+/**
+ * @brief Schedule a timer, rescheduling it if it is already scheduled
+ *
+ * @param wheel the wheel to schedule on
+ * @param timer the timer to schedule
+ * @param seconds number of seconds until the timer expires
+ */
+void htt_timer_schedule(struct htt_timer_wheel *wheel, struct htt_timer *timer, unsigned seconds);
+
+/**
+ * @brief Cancel a timer, if it is scheduled
+ *
+ * @param wheel the wheel the timer was scheduled on
+ * @param timer the timer to cancel
+ */
+void htt_timer_cancel(struct htt_timer_wheel *wheel, struct htt_timer *timer);
+
+/**
+ * @brief Advance the wheel to the current time, expiring any timers that are due
+ * @details Expired timers are unscheduled before their callback runs.
+ *
+ * @param wheel the wheel to advance
+ * @param expire function to call for each expired timer
+ */
+void htt_timer_wheel_advance(struct htt_timer_wheel *wheel, htt_timer_expire_t expire);
+
+/**
+ * @brief Get how long to wait before the wheel needs to be advanced again
+ *
+ * @param wheel the wheel to check
+ * @return timeout in milliseconds suitable for epoll_wait, -1 if no timers are scheduled
+ */
+int htt_timer_wheel_timeout(const struct htt_timer_wheel *wheel);
+
+#endif // HTT_TIMER_WHEEL_H
@@ -0,0 +1,104 @@
+/*
+ * Turns a MIME type list (ext=type per line) into a perfect hash table that is compiled
+ * into the server, so lookups don't need the list to be parsed at startup.
+ * Usage: gen-mime-types <mime-types.txt> <output.h>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "../perfect-hash.h"
+
+static void print_string(FILE *out, const char *s) {
+	fputc('"', out);
+	for (; *s; ++s) {
+		if (*s == '"' || *s == '\\') fputc('\\', out);
+		fputc(*s, out);
+	}
+	fputc('"', out);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s <mime-types.txt> <output.h>\n", argv[0]);
+		return 1;
+	}
+
+	FILE *in = fopen(argv[1], "r");
+	if (!in) {
+		fprintf(stderr, "Failed to open %s: %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+	struct htt_phash_entry *entries = NULL;
+	size_t count = 0, cap = 0;
+	char *key, *value;
+	while (fscanf(in, "%m[^=]=%ms\n", &key, &value) == 2) {
+		if (count == cap) {
+			cap = cap ? cap * 2 : 256;
+			entries = realloc(entries, cap * sizeof(*entries));
+			if (!entries) {
+				fprintf(stderr, "Out of memory\n");
+				return 1;
+			}
+		}
+		for (char *c = key; *c; ++c) *c = htt_phash_lower(*c);
+		entries[count++] = (struct htt_phash_entry) { key, value };
+	}
+	fclose(in);
+	if (!count) {
+		fprintf(stderr, "No MIME types found in %s\n", argv[1]);
+		return 1;
+	}
+
+	struct htt_phash table;
+	if (htt_phash_build(&table, entries, count)) {
+		fprintf(stderr, "Failed to build a perfect hash table from %s\n", argv[1]);
+		return 1;
+	}
+
+	// written under a temporary name, so a failed run doesn't leave a half-written header
+	char tmp_path[4096];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", argv[2]);
+	FILE *out = fopen(tmp_path, "w");
+	if (!out) {
+		fprintf(stderr, "Failed to open %s: %s\n", tmp_path, strerror(errno));
+		return 1;
+	}
+
+	fprintf(out, "// Generated from %s by tools/gen-mime-types, do not edit.\n\n", argv[1]);
+	fprintf(out, "static const uint32_t BUILTIN_MIME_DISPLACEMENTS[%u] = {", table.bucket_count);
+	for (uint32_t i = 0; i < table.bucket_count; ++i) {
+		fprintf(out, "%s%u,", i % 16 ? " " : "\n\t", table.displacements[i]);
+	}
+	fprintf(out, "\n};\n\n");
+
+	fprintf(out, "static const struct htt_phash_entry BUILTIN_MIME_ENTRIES[%u] = {\n", table.size);
+	for (uint32_t i = 0; i < table.size; ++i) {
+		fputs("\t{ ", out);
+		print_string(out, table.entries[i].key);
+		fputs(", ", out);
+		print_string(out, table.entries[i].value);
+		fputs(" },\n", out);
+	}
+	fprintf(out, "};\n\n");
+
+	fprintf(out,
+		"static const struct htt_phash BUILTIN_MIME_TYPES = {\n"
+		"\t.seed = 0x%016llxULL,\n"
+		"\t.bucket_count = %u,\n"
+		"\t.size = %u,\n"
+		"\t.displacements = BUILTIN_MIME_DISPLACEMENTS,\n"
+		"\t.entries = BUILTIN_MIME_ENTRIES\n"
+		"};\n",
+		(unsigned long long) table.seed, table.bucket_count, table.size
+	);
+
+	if (fclose(out) || rename(tmp_path, argv[2])) {
+		fprintf(stderr, "Failed to write %s: %s\n", argv[2], strerror(errno));
+		remove(tmp_path);
+		return 1;
+	}
+	return 0;
+}
@@ -32,11 +32,12 @@ char *htt_trie_insert(struct htt_trie *t, const char *key, char *value) {
 			struct htt_trie **child = &t->children[i & 7];
 			t = *child = *child ? *child : htt_trie_create();
 			if (!t) return NULL;
-			++key;
 			i >>= 3;
 		}
+		++key;
 	}
 	
+	if (t->value != value) free(t->value);
 	t->value = value;
 	return t->value;
 }
@@ -47,10 +48,149 @@ char *htt_trie_search(struct htt_trie *t, const char *key) {
 		for (int j = 2; j > 0; --j) {
 			t = t->children[i & 7];
 			if (!t) return NULL;
-			++key;
 			i >>= 3;
 		}
+		++key;
 	}
 	
 	return t->value;
 }
+
+// a node's child for a whole character, found two levels down
+static struct htt_trie *char_child(const struct htt_trie *t, int i) {
+	const struct htt_trie *half = t->children[i & 7];
+	return half ? half->children[i >> 3] : NULL;
+}
+
+static void count_nodes(const struct htt_trie *t, size_t *nodes, size_t *values) {
+	++*nodes;
+	if (t->value) ++*values;
+	for (int i = 0; i < 64; ++i) {
+		struct htt_trie *child = char_child(t, i);
+		if (child) count_nodes(child, nodes, values);
+	}
+}
+
+// make sure cells up to count exist, with new ones unused
+static int reserve_cells(struct htt_flat_trie *flat, size_t count) {
+	if (count <= flat->cell_count) return 0;
+	size_t cap = flat->cell_count ? flat->cell_count : 256;
+	while (cap < count) cap *= 2;
+	struct htt_flat_trie_cell *cells = realloc(flat->cells, cap * sizeof(*cells));
+	if (!cells) return -1;
+	for (size_t i = flat->cell_count; i < cap; ++i) {
+		cells[i] = (struct htt_flat_trie_cell) { .check = HTT_FLAT_TRIE_EMPTY };
+	}
+	flat->cells = cells;
+	flat->cell_count = cap;
+	return 0;
+}
+
+// find the first base where every child in mask lands on an unused cell
+static int64_t find_base(struct htt_flat_trie *flat, uint64_t mask, size_t *first_free) {
+	while (*first_free < flat->cell_count && flat->cells[*first_free].check != HTT_FLAT_TRIE_EMPTY) {
+		++*first_free;
+	}
+	int lowest = __builtin_ctzll(mask);
+	size_t base = *first_free > (size_t) lowest + 1 ? *first_free - lowest : 1;
+	for (;; ++base) {
+		if (base + 64 > UINT32_MAX || reserve_cells(flat, base + 64)) return -1;
+		uint64_t m = mask;
+		while (m && flat->cells[base + __builtin_ctzll(m)].check == HTT_FLAT_TRIE_EMPTY) m &= m - 1;
+		if (!m) return base;
+	}
+}
+
+struct htt_flat_trie *htt_trie_freeze(struct htt_trie *t) {
+	if (!t) return NULL;
+	size_t node_count = 0, value_count = 0;
+	count_nodes(t, &node_count, &value_count);
+	
+	struct htt_flat_trie *flat = calloc(1, sizeof(*flat));
+	struct freeze_item { struct htt_trie *src; uint32_t cell; } *queue = malloc(node_count * sizeof(*queue));
+	if (flat) flat->values = malloc((value_count ? value_count : 1) * sizeof(*flat->values));
+	if (!flat || !queue || !flat->values || reserve_cells(flat, 64)) goto fail;
+	
+	// the root checks itself, so its cell counts as used. no node has a child in cell 0,
+	// since bases start at 1.
+	flat->cells[0].check = 0;
+	queue[0] = (struct freeze_item) { t, 0 };
+	size_t tail = 1, first_free = 1, end = 64;
+	for (size_t head = 0; head < tail; ++head) {
+		struct htt_trie *src = queue[head].src;
+		uint32_t cell = queue[head].cell;
+		if (src->value) {
+			flat->values[flat->value_count++] = src->value;
+			flat->cells[cell].value = flat->value_count;
+			src->value = NULL;
+		}
+		
+		uint64_t mask = 0;
+		for (int i = 0; i < 64; ++i) {
+			if (char_child(src, i)) mask |= 1ULL << i;
+		}
+		if (!mask) continue;
+		
+		int64_t base = find_base(flat, mask, &first_free);
+		if (base < 0) goto fail;
+		flat->cells[cell].base = base;
+		if ((size_t) base + 64 > end) end = base + 64;
+		for (uint64_t m = mask; m; m &= m - 1) {
+			int i = __builtin_ctzll(m);
+			flat->cells[base + i].check = cell;
+			queue[tail++] = (struct freeze_item) { char_child(src, i), base + i };
+		}
+	}
+	
+	// every base + 63 has to stay in bounds, but nothing past that is ever read
+	struct htt_flat_trie_cell *cells = realloc(flat->cells, end * sizeof(*cells));
+	if (cells) {
+		flat->cells = cells;
+		flat->cell_count = end;
+	}
+	
+	free(queue);
+	htt_trie_destroy(t);
+	return flat;
+	
+fail:
+	htt_flat_trie_destroy(flat);
+	free(queue);
+	htt_trie_destroy(t);
+	return NULL;
+}
+
+struct htt_flat_trie *htt_flat_trie_build(const char *const *keys, char **values, size_t count) {
+	struct htt_trie *t = htt_trie_create();
+	for (size_t i = 0; i < count; ++i) {
+		if (!t || !htt_trie_insert(t, keys[i], values[i])) {
+			// values that weren't handed to the trie still have to be freed
+			for (; i < count; ++i) free(values[i]);
+			htt_trie_destroy(t);
+			return NULL;
+		}
+	}
+	return htt_trie_freeze(t);
+}
+
+void htt_flat_trie_destroy(struct htt_flat_trie *t) {
+	if (!t) return;
+	for (size_t i = 0; i < t->value_count; ++i) free(t->values[i]);
+	free(t->values);
+	free(t->cells);
+	free(t);
+}
+
+char *htt_flat_trie_search(const struct htt_flat_trie *t, const char *key) {
+	const struct htt_flat_trie_cell *cells = t->cells;
+	uint32_t node = 0;
+	int i;
+	while ((i = ctoindex(*key)) != -1) {
+		uint32_t next = cells[node].base + i;
+		if (cells[next].check != node) return NULL;
+		node = next;
+		++key;
+	}
+	
+	return cells[node].value ? t->values[cells[node].value - 1] : NULL;
+}
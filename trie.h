@@ -1,6 +1,9 @@
 #ifndef HTT_TRIE_H
 #define HTT_TRIE_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 // trie supports ASCII alphanumeric + special characters, case insensitive
 struct htt_trie {
 	struct htt_trie *children[8];
@@ -16,4 +19,35 @@ char *htt_trie_insert(struct htt_trie *t, const char *key, char *value);
 
 char *htt_trie_search(struct htt_trie *t, const char *key);
 
+// a cell of a double-array trie. the child of the node in cell n for a character is in
+// cell cells[n].base + index of the character, if that cell's check is n.
+struct htt_flat_trie_cell {
+	uint32_t base;
+	uint32_t check; // cell of the parent, HTT_FLAT_TRIE_EMPTY if the cell is unused
+	uint32_t value; // index into values plus one, 0 if no key ends here
+};
+
+#define HTT_FLAT_TRIE_EMPTY UINT32_MAX
+
+// a read-only trie in one array, with the root in cell 0. a lookup reads one cell per
+// character, and the children of a node sit close together.
+struct htt_flat_trie {
+	struct htt_flat_trie_cell *cells;
+	char **values;
+	size_t cell_count;
+	size_t value_count;
+};
+
+// moves everything in t into a flat trie and destroys t, even if freezing fails.
+// returns NULL if memory couldn't be allocated.
+struct htt_flat_trie *htt_trie_freeze(struct htt_trie *t);
+
+// builds a flat trie from count keys, taking ownership of the values the same way
+// htt_trie_insert does. a later duplicate key replaces an earlier one.
+struct htt_flat_trie *htt_flat_trie_build(const char *const *keys, char **values, size_t count);
+
+void htt_flat_trie_destroy(struct htt_flat_trie *t);
+
+char *htt_flat_trie_search(const struct htt_flat_trie *t, const char *key);
+
 #endif // HTT_TRIE_H
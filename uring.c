@@ -0,0 +1,186 @@
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz) {
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+int htt_uring_init(struct htt_uring *ring, unsigned entries) {
+	memset(ring, 0, sizeof(*ring));
+
+	// a ring is only ever used by the thread that made it, which lets the kernel skip some work.
+	// these flags are fairly new, so try again without them on older kernels.
+	struct io_uring_params p = {
+		.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER,
+		.cq_entries = entries * 4
+	};
+	ring->fd = sys_io_uring_setup(entries, &p);
+	if (ring->fd == -1 && errno == EINVAL) {
+		p = (struct io_uring_params) { .flags = IORING_SETUP_CQSIZE, .cq_entries = entries * 4 };
+		ring->fd = sys_io_uring_setup(entries, &p);
+	}
+	if (ring->fd == -1) return -1;
+
+	// timeouts are passed straight to io_uring_enter, so this one is required
+	if (!(p.features & IORING_FEAT_EXT_ARG)) {
+		close(ring->fd);
+		errno = ENOSYS;
+		return -1;
+	}
+
+	ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP && ring->cq_ring_size > ring->sq_ring_size) {
+		ring->sq_ring_size = ring->cq_ring_size;
+	}
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED) goto fail;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ring = ring->sq_ring;
+	} else {
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ring == MAP_FAILED) goto fail;
+	}
+
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) goto fail;
+
+	char *sq = ring->sq_ring;
+	ring->sq_head = (unsigned *) (sq + p.sq_off.head);
+	ring->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+	ring->sq_mask = *(unsigned *) (sq + p.sq_off.ring_mask);
+	ring->sq_entries = p.sq_entries;
+	ring->sq_local_tail = *ring->sq_tail;
+
+	unsigned *array = (unsigned *) (sq + p.sq_off.array);
+	for (unsigned i = 0; i < p.sq_entries; ++i) array[i] = i;
+
+	char *cq = ring->cq_ring;
+	ring->cq_head = (unsigned *) (cq + p.cq_off.head);
+	ring->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+	ring->cq_mask = *(unsigned *) (cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+	return 0;
+
+fail:
+	{
+		int err = errno;
+		htt_uring_destroy(ring);
+		errno = err;
+	}
+	return -1;
+}
+
+void htt_uring_destroy(struct htt_uring *ring) {
+	if (ring->buf_ring) munmap(ring->buf_ring, ring->buf_ring_size);
+	if (ring->sqes && ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+	if (ring->sq_ring && ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+}
+
+int htt_uring_register_files(struct htt_uring *ring, unsigned count) {
+	struct io_uring_rsrc_register reg = {
+		.nr = count,
+		.flags = IORING_RSRC_REGISTER_SPARSE
+	};
+	return sys_io_uring_register(ring->fd, IORING_REGISTER_FILES2, &reg, sizeof(reg)) == -1 ? -1 : 0;
+}
+
+int htt_uring_setup_buffers(struct htt_uring *ring, unsigned count, unsigned size) {
+	// the ring itself goes first, since the kernel wants it page aligned
+	size_t ring_size = count * sizeof(struct io_uring_buf);
+	size_t total = ring_size + (size_t) count * size;
+	void *mem = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) return -1;
+
+	struct io_uring_buf_reg reg = {
+		.ring_addr = (unsigned long) mem,
+		.ring_entries = count,
+		.bgid = HTT_URING_BUFFER_GROUP
+	};
+	if (sys_io_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+		int err = errno;
+		munmap(mem, total);
+		errno = err;
+		return -1;
+	}
+
+	ring->buf_ring = mem;
+	ring->bufs = (char *) mem + ring_size;
+	ring->buf_size = size;
+	ring->buf_mask = count - 1;
+	ring->buf_tail = 0;
+	ring->buf_ring_size = total;
+	for (unsigned i = 0; i < count; ++i) htt_uring_recycle_buffer(ring, i);
+	return 0;
+}
+
+void htt_uring_recycle_buffer(struct htt_uring *ring, unsigned short bid) {
+	struct io_uring_buf *buf = &ring->buf_ring->bufs[ring->buf_tail & ring->buf_mask];
+	buf->addr = (unsigned long) htt_uring_buffer(ring, bid);
+	buf->len = ring->buf_size;
+	buf->bid = bid;
+	__atomic_store_n(&ring->buf_ring->tail, ++ring->buf_tail, __ATOMIC_RELEASE);
+}
+
+// make queued entries visible to the kernel, returns how many are waiting to be submitted
+static unsigned flush_sq(struct htt_uring *ring) {
+	__atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+	return ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+}
+
+struct io_uring_sqe *htt_uring_get_sqe(struct htt_uring *ring) {
+	if (ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+		// out of room, so submit what we have without waiting for anything
+		unsigned pending = flush_sq(ring);
+		if (sys_io_uring_enter(ring->fd, pending, 0, 0, NULL, 0) == -1) return NULL;
+		if (ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) return NULL;
+	}
+
+	struct io_uring_sqe *sqe = &ring->sqes[ring->sq_local_tail++ & ring->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+int htt_uring_submit_and_wait(struct htt_uring *ring, int timeout_ms) {
+	struct __kernel_timespec ts = {
+		.tv_sec = timeout_ms / 1000,
+		.tv_nsec = (timeout_ms % 1000) * 1000000L
+	};
+	struct io_uring_getevents_arg arg = {
+		.sigmask = 0,
+		.sigmask_sz = _NSIG / 8,
+		.ts = timeout_ms < 0 ? 0 : (unsigned long long) &ts
+	};
+
+	unsigned pending = flush_sq(ring);
+	unsigned min_complete = timeout_ms ? 1 : 0;
+	if (sys_io_uring_enter(ring->fd, pending, min_complete, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg)) == -1) {
+		// running out of time or being interrupted is just an empty wakeup, and a busy
+		// completion queue only needs to be drained
+		if (errno == ETIME || errno == EINTR || errno == EBUSY) return 0;
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,151 @@
+/**
+ * @file uring.h
+ * @author Will Brown
+ * @brief Minimal io_uring wrapper built directly on the system calls
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026 Will Brown
+ */
+
+#ifndef HTT_URING_H
+#define HTT_URING_H
+
+#include <stddef.h>
+
+#include <linux/io_uring.h>
+
+/**
+ * @brief Buffer group recvs select from
+ */
+#define HTT_URING_BUFFER_GROUP 0
+
+/**
+ * @brief An io_uring instance and its mapped queues
+ * @details Submission queue entries are handed out in order, so the index array is set up
+ * once as an identity mapping and never touched again.
+ */
+struct htt_uring {
+    int fd;
+    unsigned *sq_head; ///< Advanced by the kernel as it consumes entries
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_local_tail; ///< Tail including entries that haven't been published yet
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail; ///< Advanced by the kernel as it posts completions
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring; ///< Mapping for the submission ring, shared with the completion ring if possible
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    struct io_uring_buf_ring *buf_ring; ///< Provided buffers for recvs, NULL if they aren't set up
+    char *bufs; ///< Memory the provided buffers point into
+    unsigned buf_size;
+    unsigned buf_mask;
+    unsigned short buf_tail; ///< Only the kernel reads the ring's tail, so this is the real one
+    size_t buf_ring_size; ///< Size of the mapping holding the ring and the buffers
+};
+
+/**
+ * @brief Set up an io_uring instance
+ *
+ * @param ring ring to set up
+ * @param entries number of submission queue entries, the completion queue is larger
+ * @return 0 on success, -1 on failure with errno set
+ */
+int htt_uring_init(struct htt_uring *ring, unsigned entries);
+
+/**
+ * @brief Tear down an io_uring instance
+ *
+ * @param ring ring to destroy
+ */
+void htt_uring_destroy(struct htt_uring *ring);
+
+/**
+ * @brief Register a sparse table of files, which requests can refer to by index
+ * @details Slots are filled and cleared with IORING_OP_FILES_UPDATE. A request on a registered
+ * file skips looking up and reference counting the file every time it runs.
+ *
+ * @param ring ring to register the table with
+ * @param count number of slots
+ * @return 0 on success, -1 on failure with errno set
+ */
+int htt_uring_register_files(struct htt_uring *ring, unsigned count);
+
+/**
+ * @brief Register a ring of provided buffers for recvs to fill
+ * @details A recv with IOSQE_BUFFER_SELECT in HTT_URING_BUFFER_GROUP picks a buffer only once
+ * data has arrived, so idle connections don't tie up any memory. The buffer's id is in the
+ * upper bits of the completion's flags, and it belongs to the caller until it is recycled.
+ *
+ * @param ring ring to register the buffers with
+ * @param count number of buffers, a power of 2
+ * @param size size of each buffer
+ * @return 0 on success, -1 on failure with errno set
+ */
+int htt_uring_setup_buffers(struct htt_uring *ring, unsigned count, unsigned size);
+
+/**
+ * @brief Get the data of a provided buffer
+ *
+ * @param ring ring the buffer belongs to
+ * @param bid id of the buffer
+ * @return start of the buffer
+ */
+static inline char *htt_uring_buffer(const struct htt_uring *ring, unsigned short bid) {
+    return ring->bufs + (size_t) bid * ring->buf_size;
+}
+
+/**
+ * @brief Hand a provided buffer back to the kernel once its data has been read
+ *
+ * @param ring ring the buffer belongs to
+ * @param bid id of the buffer
+ */
+void htt_uring_recycle_buffer(struct htt_uring *ring, unsigned short bid);
+
+/**
+ * @brief Get a cleared submission queue entry
+ * @details Entries are only submitted by htt_uring_submit_and_wait, unless the queue fills up.
+ *
+ * @param ring ring to get an entry from
+ * @return the entry, or NULL if the queue is full and couldn't be submitted
+ */
+struct io_uring_sqe *htt_uring_get_sqe(struct htt_uring *ring);
+
+/**
+ * @brief Submit all queued entries and wait for at least one completion
+ *
+ * @param ring ring to submit to
+ * @param timeout_ms longest time to wait in milliseconds, -1 to wait forever
+ * @return 0 on success, even if the wait timed out, -1 on failure with errno set
+ */
+int htt_uring_submit_and_wait(struct htt_uring *ring, int timeout_ms);
+
+/**
+ * @brief Get the oldest completion that hasn't been seen yet
+ *
+ * @param ring ring to check
+ * @return the completion, or NULL if there are none
+ */
+static inline struct io_uring_cqe *htt_uring_peek_cqe(struct htt_uring *ring) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) return NULL;
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+/**
+ * @brief Mark the completion returned by htt_uring_peek_cqe as seen, so its slot can be reused
+ *
+ * @param ring ring the completion came from
+ */
+static inline void htt_uring_cqe_seen(struct htt_uring *ring) {
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+#endif // HTT_URING_H